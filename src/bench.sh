@@ -0,0 +1,61 @@
+#!/bin/bash
+
+set -euo pipefail
+
+# Usage: bench.sh [nodes...]
+# Runs every simulator on generated topologies of about the given sizes, and
+# prints one tab-separated row per run.
+SIZES="${*:-16 36 64}"
+PROTOCOLS="dv dvrpp dv-delta dvrpp-delta pv ls"
+BIN_DIR="$(dirname "$0")/../bin"
+
+TEMP_DIR="$(mktemp -d)"
+
+function cleanup {
+	rm -rf "$TEMP_DIR"
+}
+trap cleanup EXIT
+
+# Generate topologies, each with a few link flaps after convergence.
+for NODES in $SIZES; do
+	SIDE="$(awk "BEGIN { print int(sqrt($NODES)) }")"
+	K="$(awk "BEGIN { k = 2; while (5 * (k + 2) * (k + 2) / 4 <= $NODES) k += 2; print k }")"
+	GENERATE="$BIN_DIR/gen-topology --seed $NODES --costs 1 10 --flaps 4 $((NODES * 2))"
+	$GENERATE ring "$NODES" > "$TEMP_DIR/ring-$NODES.net"
+	$GENERATE grid "$SIDE" "$SIDE" > "$TEMP_DIR/grid-$NODES.net"
+	$GENERATE er "$NODES" 4 > "$TEMP_DIR/er-$NODES.net"
+	$GENERATE ba "$NODES" 2 > "$TEMP_DIR/ba-$NODES.net"
+	$GENERATE fat-tree "$K" > "$TEMP_DIR/fat-tree-$NODES.net"
+done
+
+# Run each simulator on each topology.
+printf "protocol\ttopology\tnodes\tlinks\twall_s\tevents\tevents_per_s\tmessages\tpeak_rss_kb\tconvergence_epoch\n"
+for TOPOLOGY in "$TEMP_DIR"/*.net; do
+	NAME="$(basename "$TOPOLOGY" ".net")"
+	LINKS="$(awk '$1 == 0' "$TOPOLOGY" | wc -l)"
+	for PROTOCOL in $PROTOCOLS; do
+		START="$(date +%s.%N)"
+		"$BIN_DIR/$PROTOCOL-simulator" "$TOPOLOGY" --stats-csv "$TEMP_DIR/stats.csv" > "$TEMP_DIR/stdout.txt"
+		END="$(date +%s.%N)"
+
+		awk -v protocol="$PROTOCOL" -v name="${NAME%-*}" -v links="$LINKS" -v start="$START" -v end="$END" -v stats="$TEMP_DIR/stats.csv" '
+			/^Simulated network of/ { nodes = $4; events = $7 }
+			/^Processed .* messages\./ { messages = $2 }
+			/^Simulation converged after/ { epoch = $4 }
+			END {
+				FS = ","
+				# Peak RSS of the process, ru_maxrss, as of the last epoch.
+				# It lags the current RSS by a few pages at times.
+				while ((getline line < stats) > 0) {
+					split(line, fields, ",")
+					for (f = 10; f <= 11; f++) {
+						if (fields[f] + 0 > rss) {
+							rss = fields[f] + 0
+						}
+					}
+				}
+				wall = end - start
+				printf "%s\t%s\t%d\t%d\t%.3f\t%d\t%.0f\t%d\t%d\t%d\n", protocol, name, nodes, links, wall, events, events / (wall > 0 ? wall : 1e-9), messages, rss, epoch
+			}' "$TEMP_DIR/stdout.txt"
+	done
+done
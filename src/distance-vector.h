@@ -0,0 +1,385 @@
+/******************************************************************************\
+* Distance vector core, shared by the distance vector routers.                 *
+*                                                                              *
+* Holds the state, its checkpoints, the Bellman-Ford recomputation and the     *
+* incremental updates from a neighbor's costs, and with DELTA_UPDATES, the     *
+* messages with only the costs that changed. The router module defines what    *
+* it advertises to each neighbor and its full vector messages, below.          *
+* Include once, in the router module, after routing-simulator.h.               *
+\******************************************************************************/
+
+#include <assert.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "min-plus.h"
+
+#ifdef DELTA_UPDATES
+// Message format with DELTA_UPDATES, unless messages are coalesced: the
+// destinations whose cost changed since the last message to the neighbor,
+// then their new costs, in the same order.
+int delta_count(message_t message) { return message.size / (sizeof(node_t) + sizeof(cost_t)); }
+
+node_t *delta_destinations(void *data) { return (node_t *)data; }
+
+cost_t *delta_costs(void *data, int count) { return (cost_t *)(delta_destinations(data) + count); }
+#endif
+
+// State format.
+// Distance vectors of every node, get_node_count() x get_node_count().
+// The neighbors' distance vectors are buffers of their own, with the costs
+// they advertised to the current node, that messages update.
+typedef struct {
+	cost_t **dvs;
+	node_t *via;
+#ifdef DELTA_UPDATES
+	// Distance vector last sent to each neighbor, NULL for other nodes.
+	cost_t **sent;
+#endif
+
+	// Costs and next hops found by bellman_ford, to compare with the current
+	// ones.
+	cost_t *min_cost;
+	node_t *min_via;
+} state_t;
+
+// Defined by the router module.
+// Cost to node to advertise to neighbor, from the distance vector dv.
+cost_t advertised_cost(state_t *state, const cost_t *dv, node_t neighbor, node_t node);
+
+// Apply a full vector message from sender to its distance vector, update the
+// distance vector for it, and return whether it changed.
+bool update_from_vector(node_t sender, message_t message);
+
+// Send message to neighbors.
+void send_messages();
+
+// Set the cost and next hop to y in the distance vector dv, if either changed,
+// and return whether the distance vector changed.
+bool update_distance(state_t *state, cost_t *dv, node_t y, cost_t min_cost, node_t via) {
+	// If min_cost is different from the distance vector value, update it.
+	// If via is different from the previous via, update it, but signal no changes in the distance vector.
+	bool changed_dv = min_cost != dv[y];
+	bool changed_via = dv[y] != COST_INFINITY && state->via[y] != via;
+	if (changed_dv || changed_via) {
+		// Update distance vector and via, and set route.
+		dv[y] = min_cost;
+		if (min_cost != COST_INFINITY) {
+			state->via[y] = via;
+		} else {
+			state->via[y] = -1;
+		}
+		set_route(y, via, min_cost);
+	}
+
+	return changed_dv;
+}
+
+// Find the minimum cost to reach y, and the neighbor that allows it.
+// The link to y comes first, then neighbors in link order, by node, so the
+// first one with the minimum cost wins.
+cost_t find_min_cost(state_t *state, node_t y, node_t *via) {
+	const link_t *links;
+	int num_links = get_links(&links);
+	cost_t min_cost = get_link_cost(y);
+	*via = y;
+
+	for (int l = 0; l < num_links; l++) {
+		node_t z = links[l].neighbor;
+		if (z == y) {
+			continue;
+		}
+		if (COST_ADD(links[l].cost, state->dvs[z][y]) < min_cost) {
+			min_cost = COST_ADD(links[l].cost, state->dvs[z][y]);
+			*via = z;
+		}
+	}
+
+	return min_cost;
+}
+
+// Recompute distance vector.
+bool bellman_ford() {
+	state_t *state = (state_t *)get_state();
+
+	bool changed = false;
+	node_t num_nodes = get_node_count();
+	node_t current_node = get_current_node();
+	cost_t *dv = state->dvs[current_node];
+	cost_t *min_cost = state->min_cost;
+	node_t *min_via = state->min_via;
+	const link_t *links;
+	int num_links = get_links(&links);
+
+	// Start from the links to neighbors.
+	memset(min_cost, COST_INFINITY, sizeof(cost_t) * num_nodes);
+	for (node_t y = 0; y < num_nodes; y++) {
+		min_via[y] = y;
+	}
+	for (int l = 0; l < num_links; l++) {
+		min_cost[links[l].neighbor] = links[l].cost;
+	}
+
+	// D_x(y) = min { D_x(y), c(x,z) + D_z(y) }
+	// Find the minimum cost to reach each y, and the neighbor that allows it,
+	// a whole distance vector at a time, as find_min_cost does. Going through z
+	// to reach z itself is never cheaper than its link, so it needs no skipping.
+	for (int l = 0; l < num_links; l++) {
+		if (links[l].cost < COST_INFINITY) {
+			min_plus_row(min_cost, min_via, state->dvs[links[l].neighbor], links[l].cost, links[l].neighbor, num_nodes);
+		}
+	}
+
+	node_t last_node = get_last_node();
+	for (node_t y = get_first_node(); y <= last_node; y = get_next_node(y)) {
+		if (y != current_node && update_distance(state, dv, y, min_cost[y], min_via[y])) {
+			changed = true;
+		}
+	}
+
+	return changed;
+}
+
+// Update the cost to y for the sender's cost to it changing from
+// old_sender_cost, and return whether the distance vector changed. Only the costs through the
+// sender changed, so the minimum to y only changes where the sender now beats
+// it, or ties with it ahead of the current next hop, or where the sender was
+// the next hop and got worse. Only then is every neighbor checked again.
+bool update_from_neighbor(state_t *state, cost_t *dv, node_t sender, cost_t link_cost, node_t y, cost_t old_sender_cost) {
+	cost_t old_cost = COST_ADD(link_cost, old_sender_cost);
+	cost_t new_cost = COST_ADD(link_cost, state->dvs[sender][y]);
+	if (new_cost == old_cost) {
+		return false;
+	}
+
+	if (new_cost < dv[y] || (new_cost == dv[y] && state->via[y] != y && sender < state->via[y])) {
+		return update_distance(state, dv, y, new_cost, sender);
+	} else if (state->via[y] == sender) {
+		node_t via;
+		cost_t min_cost = find_min_cost(state, y, &via);
+		return update_distance(state, dv, y, min_cost, via);
+	}
+	return false;
+}
+
+#ifdef DELTA_UPDATES
+// Apply the costs that changed in a message from sender to its distance
+// vector, update the distance vector for them, and return whether it changed.
+bool update_from_deltas(node_t sender, message_t message) {
+	state_t *state = (state_t *)get_state();
+
+	bool changed = false;
+	node_t current_node = get_current_node();
+	cost_t *dv = state->dvs[current_node];
+	cost_t link_cost = get_link_cost(sender);
+
+	int num_deltas = delta_count(message);
+	node_t *destinations = delta_destinations(message.data);
+	cost_t *costs = delta_costs(message.data, num_deltas);
+	for (int d = 0; d < num_deltas; d++) {
+		node_t y = destinations[d];
+		cost_t old_cost = state->dvs[sender][y];
+		state->dvs[sender][y] = costs[d];
+		if (y != current_node && update_from_neighbor(state, dv, sender, link_cost, y, old_cost)) {
+			changed = true;
+		}
+	}
+
+	return changed;
+}
+
+// Send each neighbor the costs that changed since the last message to it, if
+// any.
+void send_deltas() {
+	state_t *state = (state_t *)get_state();
+	cost_t *dv = state->dvs[get_current_node()];
+
+	const link_t *links;
+	int num_links = get_links(&links);
+	for (int l = 0; l < num_links; l++) {
+		// Skip links that are down.
+		node_t neighbor = links[l].neighbor;
+		if (links[l].cost == COST_INFINITY) {
+			continue;
+		}
+
+		cost_t *sent = state->sent[neighbor];
+		int num_deltas = 0;
+		for (node_t node = get_first_node(); node <= get_last_node(); node = get_next_node(node)) {
+			num_deltas += advertised_cost(state, dv, neighbor, node) != sent[node];
+		}
+		if (num_deltas == 0) {
+			continue;
+		}
+
+		// Create message.
+		message_t message = create_message((sizeof(node_t) + sizeof(cost_t)) * num_deltas);
+		node_t *destinations = delta_destinations(message.data);
+		cost_t *costs = delta_costs(message.data, num_deltas);
+		int d = 0;
+		for (node_t node = get_first_node(); node <= get_last_node(); node = get_next_node(node)) {
+			cost_t cost = advertised_cost(state, dv, neighbor, node);
+			if (cost != sent[node]) {
+				destinations[d] = node;
+				costs[d++] = cost;
+				sent[node] = cost;
+			}
+		}
+
+		send_shared_message(neighbor, message);
+		release_message(message);
+	}
+}
+#endif
+
+// Handler for the node to allocate and initialize its state.
+void *init_state() {
+	state_t *state = (state_t *)malloc(sizeof(state_t));
+
+	// Allocate memory.
+	node_t num_nodes = get_node_count();
+	state->dvs = (cost_t **)malloc(sizeof(cost_t *) * num_nodes);
+	state->dvs[get_current_node()] = (cost_t *)malloc(sizeof(cost_t) * num_nodes);
+	state->via = (node_t *)malloc(sizeof(node_t) * num_nodes);
+	state->min_cost = (cost_t *)malloc(sizeof(cost_t) * num_nodes);
+	state->min_via = (node_t *)malloc(sizeof(node_t) * num_nodes);
+
+	// Initialize distance vector.
+	for (node_t node = get_first_node(); node <= get_last_node(); node = get_next_node(node)) {
+		state->dvs[get_current_node()][node] = get_link_cost(node);
+	}
+
+	// Initialize the distance vector of the other nodes.
+	// Non-neighbors never send any, so they all share one vector of
+	// COST_INFINITY.
+	cost_t *unknown = (cost_t *)malloc(sizeof(cost_t) * num_nodes);
+	memset(unknown, COST_INFINITY, sizeof(cost_t) * num_nodes);
+	for (node_t node = get_first_node(); node <= get_last_node(); node = get_next_node(node)) {
+		if (node != get_current_node()) {
+			state->dvs[node] = unknown;
+		}
+	}
+
+	// Neighbors get distance vectors of their own, for messages to update,
+	// and with DELTA_UPDATES, nothing was sent to them yet, as far as they
+	// know.
+#ifdef DELTA_UPDATES
+	state->sent = (cost_t **)calloc(num_nodes, sizeof(cost_t *));
+#endif
+	const link_t *links;
+	int num_links = get_links(&links);
+	for (int l = 0; l < num_links; l++) {
+		node_t neighbor = links[l].neighbor;
+		state->dvs[neighbor] = (cost_t *)malloc(sizeof(cost_t) * num_nodes);
+		memset(state->dvs[neighbor], COST_INFINITY, sizeof(cost_t) * num_nodes);
+#ifdef DELTA_UPDATES
+		state->sent[neighbor] = (cost_t *)malloc(sizeof(cost_t) * num_nodes);
+		memset(state->sent[neighbor], COST_INFINITY, sizeof(cost_t) * num_nodes);
+#endif
+	}
+
+	return state;
+}
+
+// Serialized state: the distance vectors of every node, then via, and with
+// DELTA_UPDATES, the distance vector last sent to each neighbor, in link order.
+int state_size() {
+	size_t num_vectors = get_node_count();
+#ifdef DELTA_UPDATES
+	const link_t *links;
+	num_vectors += get_links(&links);
+#endif
+	size_t size = sizeof(cost_t) * num_vectors * get_node_count() + sizeof(node_t) * get_node_count();
+
+	assert(size <= INT_MAX && "State too large for a checkpoint.");
+	return size;
+}
+
+void serialize_state(void *buffer) {
+	state_t *state = (state_t *)get_state();
+	node_t num_nodes = get_node_count();
+
+	cost_t *dvs = (cost_t *)buffer;
+	for (node_t node = get_first_node(); node <= get_last_node(); node = get_next_node(node)) {
+		memcpy(dvs + (size_t)node * num_nodes, state->dvs[node], sizeof(cost_t) * num_nodes);
+	}
+	memcpy(dvs + (size_t)num_nodes * num_nodes, state->via, sizeof(node_t) * num_nodes);
+
+#ifdef DELTA_UPDATES
+	cost_t *sent = (cost_t *)((node_t *)(dvs + (size_t)num_nodes * num_nodes) + num_nodes);
+	const link_t *links;
+	int num_links = get_links(&links);
+	for (int l = 0; l < num_links; l++) {
+		memcpy(sent + (size_t)l * num_nodes, state->sent[links[l].neighbor], sizeof(cost_t) * num_nodes);
+	}
+#endif
+}
+
+void *deserialize_state(const void *buffer, int size) {
+	state_t *state = (state_t *)malloc(sizeof(state_t));
+
+	// Allocate memory.
+	node_t num_nodes = get_node_count();
+	state->dvs = (cost_t **)malloc(sizeof(cost_t *) * num_nodes);
+	state->dvs[get_current_node()] = (cost_t *)malloc(sizeof(cost_t) * num_nodes);
+	state->via = (node_t *)malloc(sizeof(node_t) * num_nodes);
+	state->min_cost = (cost_t *)malloc(sizeof(cost_t) * num_nodes);
+	state->min_via = (node_t *)malloc(sizeof(node_t) * num_nodes);
+
+	// Restore distance vectors, the other nodes' ones into buffers of their own.
+	const cost_t *dvs = (const cost_t *)buffer;
+	for (node_t node = get_first_node(); node <= get_last_node(); node = get_next_node(node)) {
+		if (node != get_current_node()) {
+			state->dvs[node] = (cost_t *)malloc(sizeof(cost_t) * num_nodes);
+		}
+		memcpy(state->dvs[node], dvs + (size_t)node * num_nodes, sizeof(cost_t) * num_nodes);
+	}
+	memcpy(state->via, dvs + (size_t)num_nodes * num_nodes, sizeof(node_t) * num_nodes);
+
+#ifdef DELTA_UPDATES
+	const cost_t *sent = (const cost_t *)((const node_t *)(dvs + (size_t)num_nodes * num_nodes) + num_nodes);
+	state->sent = (cost_t **)calloc(num_nodes, sizeof(cost_t *));
+	const link_t *links;
+	int num_links = get_links(&links);
+	for (int l = 0; l < num_links; l++) {
+		state->sent[links[l].neighbor] = (cost_t *)malloc(sizeof(cost_t) * num_nodes);
+		memcpy(state->sent[links[l].neighbor], sent + (size_t)l * num_nodes, sizeof(cost_t) * num_nodes);
+	}
+#endif
+
+	return state;
+}
+
+// Notify a node that a neighboring link has changed cost.
+void notify_link_change(node_t neighbor, cost_t new_cost) {
+	// Recompute distance vector.
+	bool changed = bellman_ford();
+
+	// Send message to neighbors if distance vector changed.
+	if (changed) {
+		send_messages();
+	}
+}
+
+// Receive a message sent by a neighboring node.
+void notify_receive_message(node_t sender, message_t message) {
+#ifdef DELTA_UPDATES
+	// Update the sender's distance vector, and the distance vector.
+	if (!get_coalesce_messages()) {
+		if (update_from_deltas(sender, message)) {
+			send_messages();
+		}
+		return;
+	}
+#endif
+
+	// Update the sender's distance vector, and the distance vector.
+	bool changed = update_from_vector(sender, message);
+
+	// Send message to neighbors if distance vector changed.
+	if (changed) {
+		send_messages();
+	}
+}
@@ -0,0 +1,159 @@
+/******************************************************************************\
+* Microbenchmark of the distance vector routers' Bellman-Ford computation.     *
+*                                                                              *
+* Loads random distance vectors of a node's neighbors into its state, through  *
+* the router's checkpoint format, and times bellman_ford on them.              *
+*                                                                              *
+* Usage: dv-bench [--degree <neighbors>] [--seed <seed>] [nodes...]            *
+\******************************************************************************/
+
+#include "routing-simulator.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+// Router module entry point being measured.
+bool bellman_ford();
+
+// Minimum time to spend running each size.
+#define MIN_SECONDS 0.5
+
+static node_t num_nodes;
+static std::vector<link_t> links;
+static void *state;
+
+/******************************************************************************\
+* Router API, for a single node with no messages.                              *
+\******************************************************************************/
+
+node_t get_current_node() { return 0; }
+
+event_time_t get_current_time() { return 0; }
+
+void *get_state() { return state; }
+
+node_t get_first_node() { return 0; }
+
+node_t get_next_node(node_t node) { return node + 1; }
+
+node_t get_last_node() { return num_nodes - 1; }
+
+node_t get_node_count() { return num_nodes; }
+
+cost_t get_link_cost(node_t neighbor) {
+	for (auto &link : links) {
+		if (link.neighbor == neighbor) {
+			return link.cost;
+		}
+	}
+	return COST_INFINITY;
+}
+
+int get_links(const link_t **node_links) {
+	*node_links = links.data();
+	return links.size();
+}
+
+void set_route(node_t destination, node_t next_hop, cost_t cost) {}
+
+message_t create_message(int size) {
+	message_t message;
+	message.data = malloc(size);
+	message.size = size;
+	return message;
+}
+
+message_t retain_message(message_t message) { return message; }
+
+void release_message(message_t message) {}
+
+void send_shared_message(node_t neighbor, message_t message) {}
+
+void broadcast_message(message_t message) {}
+
+/******************************************************************************\
+* Benchmark.                                                                   *
+\******************************************************************************/
+
+// Fill the node's state, as checkpointed: random distance vectors for its
+// neighbors, unknown ones for the other nodes, then via.
+static void load_state(std::mt19937 &random_engine, int degree) {
+	std::uniform_int_distribution<int> random_cost(1, 10);
+	std::uniform_int_distribution<int> random_distance(1, 60);
+	links.clear();
+	for (node_t neighbor = 1; neighbor <= degree; neighbor++) {
+		links.push_back({neighbor, (cost_t)random_cost(random_engine)});
+	}
+
+	std::vector<char> buffer(state_size());
+	cost_t *dvs = (cost_t *)buffer.data();
+	memset(dvs, COST_INFINITY, (size_t)num_nodes * num_nodes);
+	for (node_t node = 0; node <= degree; node++) {
+		for (node_t destination = 0; destination < num_nodes; destination++) {
+			dvs[(size_t)node * num_nodes + destination] = node == destination ? 0 : random_distance(random_engine);
+		}
+	}
+	node_t *via = (node_t *)(dvs + (size_t)num_nodes * num_nodes);
+	for (node_t node = 0; node < num_nodes; node++) {
+		via[node] = -1;
+	}
+	state = deserialize_state(buffer.data(), buffer.size());
+}
+
+static void show_usage(std::string command) {
+	std::cerr << "Usage: " << command << " [--degree <neighbors>] [--seed <seed>] [nodes...]" << std::endl;
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+	int degree = 4;
+	std::mt19937 random_engine(1);
+	std::vector<node_t> sizes;
+	try {
+		for (int a = 1; a < argc; ++a) {
+			std::string arg = argv[a];
+			if (arg == "--degree" && a + 1 < argc) {
+				degree = std::stoi(argv[++a]);
+			} else if (arg == "--seed" && a + 1 < argc) {
+				random_engine.seed(std::stoi(argv[++a]));
+			} else if (arg.rfind("-", 0) == 0) {
+				show_usage(argv[0]);
+			} else {
+				sizes.push_back(std::stoi(arg));
+			}
+		}
+	} catch (...) {
+		show_usage(argv[0]);
+	}
+	if (sizes.empty()) {
+		sizes = {100, 1000, 10000};
+	}
+
+	std::cout << "nodes\tneighbors\truns\tus_per_run" << std::endl;
+	for (node_t size : sizes) {
+		if (degree < 1 || size <= degree) {
+			show_usage(argv[0]);
+		}
+		num_nodes = size;
+		load_state(random_engine, degree);
+
+		long runs = 0;
+		auto start_time = std::chrono::steady_clock::now();
+		double seconds;
+		do {
+			bellman_ford();
+			++runs;
+			seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+		} while (seconds < MIN_SECONDS);
+
+		std::cout << size << '\t' << degree << '\t' << runs << '\t' << seconds * 1e6 / runs << std::endl;
+	}
+
+	return EXIT_SUCCESS;
+}
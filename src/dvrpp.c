@@ -1,8 +1,10 @@
 /******************************************************************************\
 * Distance vector routing protocol with reverse path poisoning.                *
+*                                                                              *
+* Built with DELTA_UPDATES, each message only holds the costs that changed     *
+* since the last one to the same neighbor.                                     *
 \******************************************************************************/
 
-#include <assert.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -10,143 +12,89 @@
 
 #include "routing-simulator.h"
 
-// Message format to send between nodes.
-typedef struct {
-	cost_t dv[MAX_NODES];
-} data_t;
+#include "distance-vector.h"
 
-// State format.
-typedef struct {
-	cost_t dvs[MAX_NODES][MAX_NODES];
-	node_t via[MAX_NODES];
-} state_t;
+// Message format to send between nodes: the sender's distance vector, with
+// get_node_count() costs, then a bitmask of the destinations poisoned for the
+// receiver, with a bit per node.
+typedef cost_t data_t;
 
-// Recompute distance vector.
-bool bellman_ford() {
-	state_t *state = (state_t *)get_state();
-
-	bool changed = false;
-	cost_t min_cost;
-	node_t via;
+int poison_mask_size() { return (get_node_count() + 7) / 8; }
 
-	// D_x(y) = min { D_x(y), c(x,z) + D_z(y) }
-	for (node_t y = get_first_node(); y <= get_last_node(); y = get_next_node(y)) {
-		if (y == get_current_node()) {
-			continue;
-		}
+uint8_t *poison_mask(void *data) { return (uint8_t *)((data_t *)data + get_node_count()); }
 
-		min_cost = get_link_cost(y);
-		via = y;
-
-		// Find the minimum cost to reach y, and the neighbor that allows it.
-		for (node_t z = get_first_node(); z <= get_last_node(); z = get_next_node(z)) {
-			if (z == get_current_node() || z == y) {
-				continue;
-			}
-			if (COST_ADD(get_link_cost(z), state->dvs[z][y]) < min_cost) {
-				min_cost = COST_ADD(get_link_cost(z), state->dvs[z][y]);
-				via = z;
-			}
-		}
+// Cost to node to send to neighbor, with reverse path poisoning: if the route to
+// node goes through neighbor, COST_INFINITY.
+cost_t advertised_cost(state_t *state, const cost_t *dv, node_t neighbor, node_t node) {
+	return state->via[node] == neighbor && node != neighbor ? COST_INFINITY : dv[node];
+}
 
-		// If min_cost is different from the distance vector value, update it.
-		// If via is different from the previous via, update it, but signal no changes in the distance vector.
-		bool changed_dv = min_cost != state->dvs[get_current_node()][y];
-		bool changed_via = state->dvs[get_current_node()][y] != COST_INFINITY && state->via[y] != via;
-		if (changed_dv || changed_via) {
-			// Distance vector changed.
-			if (changed_dv) {
-				changed = true;
-			}
+// Apply a message from sender to its distance vector, poisoned where its
+// bitmask says so, update the distance vector for it, and return whether it
+// changed.
+bool update_from_vector(node_t sender, message_t message) {
+	state_t *state = (state_t *)get_state();
 
-			// Update distance vector and via, and set route.
-			state->dvs[get_current_node()][y] = min_cost;
-			if (min_cost != COST_INFINITY) {
-				state->via[y] = via;
-			} else {
-				state->via[y] = -1;
-			}
-			set_route(y, via, min_cost);
+	bool changed = false;
+	node_t current_node = get_current_node();
+	cost_t *dv = state->dvs[current_node];
+	cost_t link_cost = get_link_cost(sender);
+	const data_t *vector = (const data_t *)message.data;
+	const uint8_t *mask = poison_mask(message.data);
+
+	node_t last_node = get_last_node();
+	for (node_t y = get_first_node(); y <= last_node; y = get_next_node(y)) {
+		cost_t old_cost = state->dvs[sender][y];
+		state->dvs[sender][y] = mask[y / 8] & (1 << (y % 8)) ? COST_INFINITY : vector[y];
+		if (y != current_node && update_from_neighbor(state, dv, sender, link_cost, y, old_cost)) {
+			changed = true;
 		}
 	}
 
 	return changed;
 }
 
+// Send message to neighbors.
 void send_messages() {
 	state_t *state = (state_t *)get_state();
 
-	for (node_t neighbor = get_first_node(); neighbor <= get_last_node(); neighbor = get_next_node(neighbor)) {
-		// We only send the message to neighbors.
-		if (neighbor == get_current_node() || get_link_cost(neighbor) == COST_INFINITY) {
+#ifdef DELTA_UPDATES
+	// Coalesced messages replace each other, so each must hold the whole
+	// vector.
+	if (!get_coalesce_messages()) {
+		send_deltas();
+		return;
+	}
+#endif
+
+	// Send each neighbor the distance vector, with its own bitmask, over links
+	// that are up.
+	const link_t *links;
+	int num_links = get_links(&links);
+	int mask_size = poison_mask_size();
+	const cost_t *dv = state->dvs[get_current_node()];
+	for (int l = 0; l < num_links; l++) {
+		node_t neighbor = links[l].neighbor;
+		if (links[l].cost == COST_INFINITY) {
 			continue;
 		}
 
 		// Create message.
-		message_t message;
-		message.data = (data_t *)malloc(sizeof(data_t));
-		memcpy(message.data, state->dvs[get_current_node()], sizeof(data_t));
-		message.size = sizeof(message.data);
+		message_t message = create_message(sizeof(data_t) * get_node_count() + mask_size);
+		memcpy(message.data, dv, sizeof(data_t) * get_node_count());
+		uint8_t *mask = poison_mask(message.data);
+		memset(mask, 0, mask_size);
 
 		// Reverse path poisoning.
-		// If route to node goes through neighbor, set cost to COST_INFINITY.
-		data_t *data = (data_t *)message.data;
+		// If route to node goes through neighbor, set its bit in the bitmask,
+		// for the neighbor to read COST_INFINITY.
 		for (node_t node = get_first_node(); node <= get_last_node(); node = get_next_node(node)) {
 			if (state->via[node] == neighbor && node != neighbor) {
-				data->dv[node] = COST_INFINITY;
+				mask[node / 8] |= 1 << (node % 8);
 			}
 		}
 
-		send_message(neighbor, message);
-	}
-}
-
-// Handler for the node to allocate and initialize its state.
-void *init_state() {
-	state_t *state = (state_t *)malloc(sizeof(state_t));
-
-	// Initialize distance vector.
-	for (node_t node = get_first_node(); node <= get_last_node(); node = get_next_node(node)) {
-		state->dvs[get_current_node()][node] = get_link_cost(node);
-	}
-
-	// Initialize the distance vector of the other nodes.
-	for (node_t node1 = get_first_node(); node1 <= get_last_node(); node1 = get_next_node(node1)) {
-		for (node_t node2 = get_first_node(); node2 <= get_last_node(); node2 = get_next_node(node2)) {
-			if (node1 == get_current_node()) {
-				break;
-			}
-			state->dvs[node1][node2] = COST_INFINITY;
-		}
-	}
-
-	return state;
-}
-
-// Notify a node that a neighboring link has changed cost.
-void notify_link_change(node_t neighbor, cost_t new_cost) {
-	// Recompute distance vector.
-	bool changed = bellman_ford();
-
-	// Send message to neighbors if distance vector changed.
-	if (changed) {
-		send_messages();
-	}
-}
-
-// Receive a message sent by a neighboring node.
-void notify_receive_message(node_t sender, message_t message) {
-	state_t *state = (state_t *)get_state();
-
-	// Copy new distance vector from message to state.
-	data_t *data = (data_t *)message.data;
-	memcpy(state->dvs[sender], data->dv, sizeof(data->dv));
-
-	// Recompute distance vector.
-	bool changed = bellman_ford();
-
-	// Send message to neighbors if distance vector changed.
-	if (changed) {
-		send_messages();
+		send_shared_message(neighbor, message);
+		release_message(message);
 	}
 }
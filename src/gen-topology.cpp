@@ -0,0 +1,218 @@
+/******************************************************************************\
+* Generate synthetic topology files, in the .net text format.                  *
+*                                                                              *
+* Usage: gen-topology [options] <type> <parameters...> > <topology.net>        *
+\******************************************************************************/
+
+#include <algorithm>
+#include <iostream>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+
+#define COST_INFINITY 255
+
+typedef std::pair<int, int> link_t;
+
+static std::mt19937 random_engine(1);
+
+// Set of links, each with its lower numbered node first.
+static std::set<link_t> links;
+
+static void add_link(int first_node, int second_node) {
+	if (first_node != second_node) {
+		links.insert(std::make_pair(std::min(first_node, second_node), std::max(first_node, second_node)));
+	}
+}
+
+static int random_int(int min, int max) { return std::uniform_int_distribution<int>(min, max)(random_engine); }
+
+static void make_ring(int num_nodes) {
+	for (int node = 0; node < num_nodes; node++) {
+		add_link(node, (node + 1) % num_nodes);
+	}
+}
+
+static void make_grid(int width, int height) {
+	for (int y = 0; y < height; y++) {
+		for (int x = 0; x < width; x++) {
+			if (x + 1 < width) {
+				add_link(y * width + x, y * width + x + 1);
+			}
+			if (y + 1 < height) {
+				add_link(y * width + x, (y + 1) * width + x);
+			}
+		}
+	}
+}
+
+// Erdős–Rényi G(n, p), with p chosen for the average degree.
+static void make_erdos_renyi(int num_nodes, double degree) {
+	std::bernoulli_distribution has_link(std::min(1.0, degree / std::max(num_nodes - 1, 1)));
+	for (int first_node = 0; first_node < num_nodes; first_node++) {
+		for (int second_node = first_node + 1; second_node < num_nodes; second_node++) {
+			if (has_link(random_engine)) {
+				add_link(first_node, second_node);
+			}
+		}
+	}
+}
+
+// Barabási–Albert preferential attachment, each new node linking to
+// new_links existing nodes, starting from a clique of new_links + 1 nodes.
+static void make_barabasi_albert(int num_nodes, int new_links) {
+	std::vector<int> endpoints; // Each node once per link it has.
+	for (int first_node = 0; first_node <= new_links && first_node < num_nodes; first_node++) {
+		for (int second_node = first_node + 1; second_node <= new_links && second_node < num_nodes; second_node++) {
+			add_link(first_node, second_node);
+			endpoints.push_back(first_node);
+			endpoints.push_back(second_node);
+		}
+	}
+
+	for (int node = new_links + 1; node < num_nodes; node++) {
+		std::set<int> targets;
+		while ((int)targets.size() < new_links) {
+			targets.insert(endpoints[random_int(0, endpoints.size() - 1)]);
+		}
+		for (int target : targets) {
+			add_link(node, target);
+			endpoints.push_back(node);
+			endpoints.push_back(target);
+		}
+	}
+}
+
+// k-ary fat-tree of switches: (k/2)^2 core switches, and k pods of k/2
+// aggregation and k/2 edge switches each.
+static void make_fat_tree(int k) {
+	int half = k / 2;
+	int num_core = half * half;
+	for (int pod = 0; pod < k; pod++) {
+		int aggregation = num_core + pod * k;
+		int edge = aggregation + half;
+		for (int a = 0; a < half; a++) {
+			for (int c = 0; c < half; c++) {
+				add_link(aggregation + a, a * half + c);
+			}
+			for (int e = 0; e < half; e++) {
+				add_link(aggregation + a, edge + e);
+			}
+		}
+	}
+}
+
+static void show_usage(std::string command) {
+	std::cerr                                                               //
+	    << "Usage: " << command                                             //
+	    << " [--costs <min> <max>]"                                         //
+	    << " [--flaps <count> <period>]"                                    //
+	    << " [--seed <seed>]"                                               //
+	    << " [--] <type> <parameters...>" << std::endl                      //
+	    << std::endl                                                        //
+	    << "Types:" << std::endl                                            //
+	    << " ring <nodes>" << std::endl                                     //
+	    << " grid <width> <height>" << std::endl                            //
+	    << " er <nodes> <average-degree>   "                                //
+	    << "- Erdős–Rényi random graph." << std::endl                       //
+	    << " ba <nodes> <links-per-node>   "                                //
+	    << "- Barabási–Albert scale-free graph." << std::endl               //
+	    << " fat-tree <k>                  "                                //
+	    << "- k-ary fat-tree of switches, for even <k>." << std::endl       //
+	    << std::endl                                                        //
+	    << " --costs <min> <max>       "                                    //
+	    << "- Pick link costs uniformly in [<min>, <max>] (default: 1 10)." //
+	    << std::endl                                                        //
+	    << " --flaps <count> <period>  "                                    //
+	    << "- Take <count> random links down, one every <period> epochs "   //
+	    << "after convergence, each back up <period> / 2 epochs later "     //
+	    << "(default: none)."                                               //
+	    << std::endl                                                        //
+	    << " --seed <seed>             "                                    //
+	    << "- Seed for costs, links and flaps (default: 1)."                //
+	    << std::endl;
+	exit(EXIT_FAILURE);
+}
+
+static int parse_number(int argc, char *argv[], int a) {
+	if (argc <= a) {
+		show_usage(argv[0]);
+	}
+	try {
+		return std::stoi(argv[a]);
+	} catch (...) {
+		show_usage(argv[0]);
+	}
+	return 0;
+}
+
+int main(int argc, char *argv[]) {
+	// Parse command-line arguments.
+	int min_cost = 1, max_cost = 10;
+	int num_flaps = 0, flap_period = 0;
+	std::vector<int> positional;
+	bool positional_mode = false;
+
+	for (int a = 1; a < argc; ++a) {
+		std::string arg = argv[a];
+		if (arg == "--costs" && !positional_mode) {
+			min_cost = parse_number(argc, argv, ++a);
+			max_cost = parse_number(argc, argv, ++a);
+		} else if (arg == "--flaps" && !positional_mode) {
+			num_flaps = parse_number(argc, argv, ++a);
+			flap_period = parse_number(argc, argv, ++a);
+		} else if (arg == "--seed" && !positional_mode) {
+			random_engine.seed(parse_number(argc, argv, ++a));
+		} else if (arg == "--" && !positional_mode) {
+			positional_mode = true;
+		} else if (arg.rfind("-", 0) == 0 && !positional_mode) {
+			std::cerr << "Unknown option: " << arg << std::endl;
+			show_usage(argv[0]);
+		} else {
+			positional.push_back(a);
+		}
+	}
+	if (min_cost < 0 || max_cost >= COST_INFINITY || min_cost > max_cost || num_flaps < 0 || (num_flaps > 0 && flap_period < 2)) {
+		show_usage(argv[0]);
+	}
+
+	// Generate links.
+	std::string type = positional.empty() ? "" : argv[positional[0]];
+	std::vector<int> parameters;
+	for (size_t p = 1; p < positional.size(); p++) {
+		parameters.push_back(parse_number(argc, argv, positional[p]));
+	}
+	if (type == "ring" && parameters.size() == 1 && parameters[0] >= 2) {
+		make_ring(parameters[0]);
+	} else if (type == "grid" && parameters.size() == 2 && parameters[0] >= 1 && parameters[1] >= 1 && parameters[0] * parameters[1] >= 2) {
+		make_grid(parameters[0], parameters[1]);
+	} else if (type == "er" && parameters.size() == 2 && parameters[0] >= 2 && parameters[1] >= 0) {
+		make_erdos_renyi(parameters[0], parameters[1]);
+	} else if (type == "ba" && parameters.size() == 2 && parameters[1] >= 1 && parameters[0] > parameters[1]) {
+		make_barabasi_albert(parameters[0], parameters[1]);
+	} else if (type == "fat-tree" && parameters.size() == 1 && parameters[0] >= 2 && parameters[0] % 2 == 0) {
+		make_fat_tree(parameters[0]);
+	} else {
+		show_usage(argv[0]);
+	}
+
+	// Bring every link up at time 0, with a random cost.
+	std::vector<link_t> link_list(links.begin(), links.end());
+	std::vector<int> costs;
+	for (auto &link : link_list) {
+		costs.push_back(random_int(min_cost, max_cost));
+		std::cout << "0 " << link.first << " " << link.second << " " << costs.back() << "\n";
+	}
+
+	// Flap random links, starting once the initial topology has had time to
+	// converge, about one period after the start.
+	for (int flap = 0; flap < num_flaps && !link_list.empty(); flap++) {
+		int l = random_int(0, link_list.size() - 1);
+		int down_time = (flap + 1) * flap_period;
+		std::cout << down_time << " " << link_list[l].first << " " << link_list[l].second << " " << COST_INFINITY << "\n";
+		std::cout << down_time + flap_period / 2 << " " << link_list[l].first << " " << link_list[l].second << " " << costs[l] << "\n";
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -9,166 +9,615 @@
 
 #include "routing-simulator.h"
 
+// Message format to send between nodes: link state records, one after
+// another, each a node's version followed by its links that are up. Nodes
+// without a record in the message keep their link state.
 typedef struct {
-	cost_t link_cost[MAX_NODES];
+	node_t node;
 	int version;
-} link_state_t;
+	int num_links;
+} record_t;
+
+link_t *record_links(record_t *record) { return (link_t *)(record + 1); }
+
+record_t *next_record(record_t *record) { return (record_t *)(record_links(record) + record->num_links); }
+
+// List of nodes, in no particular order.
+typedef struct {
+	node_t *nodes;
+	int size;
+	int capacity;
+} node_list_t;
+
+// A link whose cost changed since the last shortest path tree.
+typedef struct {
+	node_t node;
+	node_t neighbor;
+	cost_t old_cost;
+} changed_link_t;
+
+// Flags of a node during an incremental shortest path tree update.
+#define NODE_TOUCHED 1  // Its tree entry or route needs checking.
+#define NODE_AFFECTED 2 // Its tree path used a link that got worse.
+#define NODE_SETTLED 4  // Its distance changed, and is final.
+
+// Updates to the shortest path tree with more changed links than nodes
+// rebuild it instead.
+#define MAX_CHANGED_LINKS(num_nodes) (num_nodes)
+
+// Bucket queue of nodes by distance (Dial's algorithm): distances are below
+// COST_INFINITY, so there is one bucket per distance, each a list of entries.
+// A node is added each time its distance improves, and entries left behind in
+// higher buckets are skipped when taken.
+typedef struct {
+	node_t node;
+	int next;
+} bucket_entry_t;
 
-// Message format to send between nodes.
 typedef struct {
-	link_state_t ls[MAX_NODES];
-} data_t;
+	int buckets[COST_INFINITY];
+	bucket_entry_t *entries;
+	int size;
+	int capacity;
+} bucket_queue_t;
 
 // State format.
+// Link costs of every node, get_node_count() x get_node_count(), and the
+// neighbors of every node with a link up, from its link costs, for dijkstra.
+// The shortest path tree is kept between runs, along with the links that
+// changed since, to update it incrementally.
 typedef struct {
-	cost_t cost[MAX_NODES][MAX_NODES];
-	node_t via[MAX_NODES];
-	int version[MAX_NODES];
+	cost_t **cost;
+	node_t *via;
+	int *version;
+	node_list_t *neighbors;
+	node_list_t *in_neighbors;
+	int num_zero_links;
+
+	// Shortest path tree: distance, predecessor (-1 for the current node and
+	// unreachable nodes), next hop and children of each node.
+	bool has_tree;
+	cost_t *dist;
+	node_t *pred;
+	node_t *next_hop;
+	node_t *first_child;
+	node_t *next_sibling;
+	node_t *prev_sibling;
+
+	changed_link_t *changed_links;
+	int num_changed_links;
+	uint8_t *flags;
+
+	// Link costs of a received record, COST_INFINITY between records.
+	cost_t *record_cost;
+
+	// Buffers for shortest path tree runs, kept between them: the bucket
+	// queue, and for dijkstra, whether each node is in the tree, the nodes in
+	// the order they joined it and a bucket's nodes, and for incremental
+	// updates, lists of nodes.
+	bucket_queue_t queue;
+	bool *in_tree;
+	node_t *tree;
+	node_t *bucket;
+	node_list_t touched;
+	node_list_t affected;
+	node_list_t stack;
+
+	// Counters of full, incremental and skipped SPF runs.
+	int full_spf_runs;
+	int incremental_spf_runs;
+	int skipped_spf_runs;
 } state_t;
 
-// Send message to neighbors.
-void send_messages() {
-	state_t *state = (state_t *)get_state();
+void add_to_list(node_list_t *list, node_t node) {
+	if (list->size == list->capacity) {
+		list->capacity = list->capacity ? 2 * list->capacity : 4;
+		list->nodes = (node_t *)realloc(list->nodes, sizeof(node_t) * list->capacity);
+	}
+	list->nodes[list->size++] = node;
+}
 
-	for (node_t neighbor = get_first_node(); neighbor <= get_last_node(); neighbor = get_next_node(neighbor)) {
-		// Send message only to neighbors.
-		if (neighbor == get_current_node() || get_link_cost(neighbor) == COST_INFINITY) {
-			continue;
+void remove_from_list(node_list_t *list, node_t node) {
+	for (int n = 0; n < list->size; n++) {
+		if (list->nodes[n] == node) {
+			list->nodes[n] = list->nodes[--list->size];
+			return;
 		}
+	}
+}
 
-		// Create message.
-		message_t message;
-		message.data = (data_t *)malloc(sizeof(data_t));
-		message.size = sizeof(data_t);
-		data_t *data = (data_t *)message.data;
+// Set the cost of the link from node to neighbor in the link state database,
+// keeping the neighbor lists up to date, and remember the change.
+void set_link_cost(state_t *state, node_t node, node_t neighbor, cost_t cost) {
+	cost_t old_cost = state->cost[node][neighbor];
+	if (old_cost == cost) {
+		return;
+	}
+	state->cost[node][neighbor] = cost;
+	if (node == neighbor) {
+		return;
+	}
 
-		// Copy link state.
-		for (node_t node1 = get_first_node(); node1 <= get_last_node(); node1 = get_next_node(node1)) {
-			data->ls[node1].version = state->version[node1];
-			for (node_t node2 = get_first_node(); node2 <= get_last_node(); node2 = get_next_node(node2)) {
-				data->ls[node1].link_cost[node2] = state->cost[node1][node2];
-			}
-		}
+	if (old_cost == COST_INFINITY) {
+		add_to_list(&state->neighbors[node], neighbor);
+		add_to_list(&state->in_neighbors[neighbor], node);
+	} else if (cost == COST_INFINITY) {
+		remove_from_list(&state->neighbors[node], neighbor);
+		remove_from_list(&state->in_neighbors[neighbor], node);
+	}
+	state->num_zero_links += (cost == 0) - (old_cost == 0);
 
-		send_message(neighbor, message);
+	if (state->has_tree) {
+		if (state->num_changed_links == MAX_CHANGED_LINKS(get_node_count())) {
+			state->has_tree = false;
+			return;
+		}
+		changed_link_t *change = &state->changed_links[state->num_changed_links++];
+		change->node = node;
+		change->neighbor = neighbor;
+		change->old_cost = old_cost;
 	}
 }
 
-// Check if node is in the tree.
-bool is_in_tree(node_t node, node_t *tree, size_t size) {
-	for (size_t i = 0; i < size; i++) {
-		if (tree[i] == node) {
-			return true;
+// Set node's predecessor, moving it between the children lists.
+void set_pred(state_t *state, node_t node, node_t pred) {
+	node_t old_pred = state->pred[node];
+	if (old_pred == pred) {
+		return;
+	}
+
+	if (old_pred >= 0) {
+		if (state->prev_sibling[node] >= 0) {
+			state->next_sibling[state->prev_sibling[node]] = state->next_sibling[node];
+		} else {
+			state->first_child[old_pred] = state->next_sibling[node];
+		}
+		if (state->next_sibling[node] >= 0) {
+			state->prev_sibling[state->next_sibling[node]] = state->prev_sibling[node];
 		}
 	}
 
-	return false;
+	state->pred[node] = pred;
+	if (pred >= 0) {
+		state->prev_sibling[node] = -1;
+		state->next_sibling[node] = state->first_child[pred];
+		if (state->first_child[pred] >= 0) {
+			state->prev_sibling[state->first_child[pred]] = node;
+		}
+		state->first_child[pred] = node;
+	}
 }
 
-// Get the next hop for a destination.
-node_t get_via(cost_t cost[][MAX_NODES], node_t *pred, node_t dest) {
-	// The node can't be reached.
-	if (cost[get_current_node()][dest] == COST_INFINITY) {
-		return -1;
+// Create a message with the link state records of nodes.
+message_t create_records_message(state_t *state, const node_list_t *nodes) {
+	int size = 0;
+	for (int n = 0; n < nodes->size; n++) {
+		size += sizeof(record_t) + sizeof(link_t) * state->neighbors[nodes->nodes[n]].size;
 	}
 
-	node_t node;
-	for (node = dest; pred[node] != get_current_node(); node = pred[node]) {
-		;
+	// Clear padding, as message data is saved in checkpoints.
+	message_t message = create_message(size);
+	memset(message.data, 0, size);
+
+	record_t *record = (record_t *)message.data;
+	for (int n = 0; n < nodes->size; n++) {
+		node_t node = nodes->nodes[n];
+		node_list_t *neighbors = &state->neighbors[node];
+		record->node = node;
+		record->version = state->version[node];
+		record->num_links = neighbors->size;
+		link_t *links = record_links(record);
+		for (int l = 0; l < neighbors->size; l++) {
+			links[l].neighbor = neighbors->nodes[l];
+			links[l].cost = state->cost[node][neighbors->nodes[l]];
+		}
+		record = next_record(record);
 	}
-
-	return node;
+	return message;
 }
 
-// Find the minimum cost node that is not in the tree.
-// Set min_node and min_cost to the corresponding values.
-void min(cost_t cost[][MAX_NODES], node_t *tree, size_t size, node_t *min_node, cost_t *min_cost) {
-	*min_cost = COST_INFINITY;
-	*min_node = -1;
-
-	// Iterate over all nodes.
-	for (node_t node = get_first_node(); node <= get_last_node(); node++) {
-		if (is_in_tree(node, tree, size)) {
-			continue;
+// Send the records of nodes to every neighbor except one, or to all with -1.
+void send_records(state_t *state, const node_list_t *nodes, node_t except) {
+	message_t message = create_records_message(state, nodes);
+	const link_t *links;
+	int num_links = get_links(&links);
+	for (int l = 0; l < num_links; l++) {
+		if (links[l].cost < COST_INFINITY && links[l].neighbor != except) {
+			send_shared_message(links[l].neighbor, message);
 		}
+	}
+	release_message(message);
+}
 
-		if (cost[get_current_node()][node] < *min_cost || *min_node == -1) {
-			// Found new minimum.
-			*min_cost = cost[get_current_node()][node];
-			*min_node = node;
+// Send the record of every known node to neighbor, or to all with -1.
+void send_database(state_t *state, node_t neighbor) {
+	node_list_t nodes = {NULL, 0, 0};
+	for (node_t node = get_first_node(); node <= get_last_node(); node = get_next_node(node)) {
+		if (state->version[node] > 0) {
+			add_to_list(&nodes, node);
 		}
 	}
+
+	message_t message = create_records_message(state, &nodes);
+	if (neighbor >= 0) {
+		send_shared_message(neighbor, message);
+	} else {
+		broadcast_message(message);
+	}
+	release_message(message);
+	free(nodes.nodes);
+}
+
+int compare_nodes(const void *a, const void *b) { return *(const node_t *)a - *(const node_t *)b; }
+
+void init_bucket_queue(bucket_queue_t *queue, int capacity) {
+	memset(queue->buckets, -1, sizeof(queue->buckets));
+	queue->entries = (bucket_entry_t *)malloc(sizeof(bucket_entry_t) * capacity);
+	queue->size = 0;
+	queue->capacity = capacity;
+}
+
+// Empty the queue, keeping its entries' memory.
+void clear_bucket_queue(bucket_queue_t *queue) {
+	memset(queue->buckets, -1, sizeof(queue->buckets));
+	queue->size = 0;
+}
+
+void push_bucket_queue(bucket_queue_t *queue, node_t node, cost_t dist) {
+	if (queue->size == queue->capacity) {
+		queue->capacity *= 2;
+		queue->entries = (bucket_entry_t *)realloc(queue->entries, sizeof(bucket_entry_t) * queue->capacity);
+	}
+	queue->entries[queue->size].node = node;
+	queue->entries[queue->size].next = queue->buckets[dist];
+	queue->buckets[dist] = queue->size++;
 }
 
-// Compute the shortest path tree.
+// Compute the shortest path tree from scratch.
+// Each bucket joins the tree in node order, so ties are broken towards the
+// lowest node, as with a linear scan for the minimum.
 void dijkstra() {
 	state_t *state = (state_t *)get_state();
+	node_t num_nodes = get_node_count();
+	node_t current_node = get_current_node();
+	cost_t *dist = state->dist;
+	node_t *pred = state->pred;
 
-	// Initialize predecessors.
-	node_t pred[MAX_NODES];
+	// Initialize distances and predecessors with the current node's link costs.
+	// Only the current node's row of the cost matrix is ever updated.
 	for (node_t node = 0; node <= get_last_node(); node = get_next_node(node)) {
-		pred[node] = get_current_node();
+		dist[node] = state->cost[current_node][node];
+		pred[node] = node == current_node || dist[node] == COST_INFINITY ? -1 : current_node;
+		state->first_child[node] = -1;
 	}
 
-	// Initialize cost matrix.
-	cost_t cost[MAX_NODES][MAX_NODES];
-	for (node_t node1 = 0; node1 <= get_last_node(); node1 = get_next_node(node1)) {
-		for (node_t node2 = 0; node2 <= get_last_node(); node2 = get_next_node(node2)) {
-			cost[node1][node2] = state->cost[node1][node2];
+	bucket_queue_t *queue = &state->queue;
+	clear_bucket_queue(queue);
+	for (node_t node = 0; node <= get_last_node(); node = get_next_node(node)) {
+		if (node != current_node && dist[node] < COST_INFINITY) {
+			push_bucket_queue(queue, node, dist[node]);
 		}
 	}
 
-	// Start by checking the current node.
-	int size = 0;
-	node_t tree[MAX_NODES];
-	tree[size++] = get_current_node();
+	// Nodes in the tree, in the order they joined it, starting with the current node.
+	bool *in_tree = state->in_tree;
+	node_t *tree = state->tree;
+	node_t *bucket = state->bucket;
+	memset(in_tree, 0, sizeof(bool) * num_nodes);
+	int tree_size = 0;
+	in_tree[current_node] = true;
+	tree[tree_size++] = current_node;
+
+	for (int d = 0; d < COST_INFINITY; d++) {
+		// Take the bucket's nodes still at this distance, in node order.
+		int bucket_size = 0;
+		for (int e = queue->buckets[d]; e != -1; e = queue->entries[e].next) {
+			if (dist[queue->entries[e].node] == d && !in_tree[queue->entries[e].node]) {
+				bucket[bucket_size++] = queue->entries[e].node;
+			}
+		}
+		qsort(bucket, bucket_size, sizeof(node_t), compare_nodes);
+
+		for (int b = 0; b < bucket_size; b++) {
+			// Add it to the tree.
+			node_t w = bucket[b];
+			in_tree[w] = true;
+			tree[tree_size++] = w;
+
+			// Update the cost of every neighbor x of w not in the tree.
+			// D[x] = min{ D[x], (D[w] + c[w][x]) }
+			for (int n = 0; n < state->neighbors[w].size; n++) {
+				node_t x = state->neighbors[w].nodes[n];
+				cost_t new_cost = COST_ADD(dist[w], state->cost[w][x]);
+				if (in_tree[x] || new_cost >= dist[x]) {
+					continue;
+				}
+
+				dist[x] = new_cost;
+				pred[x] = w;
+				if (new_cost == d) {
+					// Zero cost link, x joins this bucket in node order.
+					int position = bucket_size++;
+					for (; position > b + 1 && bucket[position - 1] > x; position--) {
+						bucket[position] = bucket[position - 1];
+					}
+					bucket[position] = x;
+				} else {
+					push_bucket_queue(queue, x, new_cost);
+				}
+			}
+		}
+	}
 
-	// While all the nodes are not in the tree.
-	while (size != get_last_node() + 1) {
-		cost_t min_cost = COST_INFINITY;
-		node_t w = -1;
+	// Unreachable nodes come last.
+	for (node_t node = 0; node <= get_last_node(); node = get_next_node(node)) {
+		if (!in_tree[node]) {
+			tree[tree_size++] = node;
+		}
+	}
+
+	// Link the children, and update nodes. Predecessors join the tree first,
+	// so each node's next hop is its predecessor's, or the node itself next to
+	// the current node.
+	for (int n = 0; n < tree_size; n++) {
+		node_t node = tree[n];
+		node_t via = pred[node] < 0 ? -1 : pred[node] == current_node ? node : state->next_hop[pred[node]];
+		state->next_hop[node] = via;
+		if (pred[node] >= 0) {
+			node_t parent = pred[node];
+			pred[node] = -1;
+			set_pred(state, node, parent);
+		}
+
+		// Already up to date.
+		if (node == current_node || (state->cost[current_node][node] == dist[node] && state->via[node] == via)) {
+			continue;
+		}
 
-		// Find the node with the minimum cost that is not in the tree.
-		min(cost, tree, size, &w, &min_cost);
+		// Update via and set route.
+		state->via[node] = via;
+		set_route(node, via, dist[node]);
+	}
 
-		// Add it to the tree.
-		tree[size++] = w;
+	state->has_tree = true;
+	state->num_changed_links = 0;
+}
 
-		// Iterate over every node x not in the tree and update the cost.
-		// D[x] = min{ D[x], (D[w] + c[w][x]) }
-		for (node_t x = get_first_node(); x <= get_last_node(); x = get_next_node(x)) {
-			if (is_in_tree(x, tree, size)) {
+// Flag node, and add it to the list of touched nodes the first time.
+void touch_node(state_t *state, node_list_t *touched, node_t node, uint8_t flags) {
+	if (!state->flags[node]) {
+		add_to_list(touched, node);
+	}
+	state->flags[node] |= flags | NODE_TOUCHED;
+}
+
+// Update the shortest path tree for the links that changed since the last run,
+// as incremental SPF does. Nodes whose tree path used a link that got worse
+// lose their distance, and get it back from their neighbors outside that part
+// of the tree. Then distances that improve are spread as in dijkstra, from
+// those nodes and from links that got better. Only nodes next to a changed
+// distance or link can change predecessor.
+// The tree is the same as dijkstra's: with positive costs, dijkstra settles
+// nodes by distance then node, so each node's predecessor is the lowest such
+// node it can be reached from at its distance, or the current node if linked
+// to it at that cost. Returns whether the tree changed.
+bool update_shortest_path_tree() {
+	state_t *state = (state_t *)get_state();
+	node_t current_node = get_current_node();
+	cost_t *dist = state->dist;
+	node_t *pred = state->pred;
+	uint8_t *flags = state->flags;
+	node_list_t *touched = &state->touched;
+	node_list_t *affected = &state->affected;
+	node_list_t *stack = &state->stack;
+	touched->size = 0;
+	affected->size = 0;
+	stack->size = 0;
+	bool changed = false;
+
+	// Forget the distances of the nodes under links that got worse.
+	for (int c = 0; c < state->num_changed_links; c++) {
+		changed_link_t *change = &state->changed_links[c];
+		touch_node(state, touched, change->neighbor, 0);
+		if (state->cost[change->node][change->neighbor] < change->old_cost || pred[change->neighbor] != change->node ||
+		    (flags[change->neighbor] & NODE_AFFECTED)) {
+			continue;
+		}
+
+		int first = affected->size;
+		touch_node(state, touched, change->neighbor, NODE_AFFECTED);
+		add_to_list(affected, change->neighbor);
+		for (int a = first; a < affected->size; a++) {
+			for (node_t child = state->first_child[affected->nodes[a]]; child >= 0; child = state->next_sibling[child]) {
+				if (!(flags[child] & NODE_AFFECTED)) {
+					touch_node(state, touched, child, NODE_AFFECTED);
+					add_to_list(affected, child);
+				}
+			}
+		}
+	}
+	for (int a = 0; a < affected->size; a++) {
+		dist[affected->nodes[a]] = COST_INFINITY;
+	}
+
+	// Start from the best links into those nodes from the rest of the tree, and
+	// from links that got better.
+	bucket_queue_t *queue = &state->queue;
+	clear_bucket_queue(queue);
+	for (int a = 0; a < affected->size; a++) {
+		node_t node = affected->nodes[a];
+		node_list_t *in_neighbors = &state->in_neighbors[node];
+		for (int n = 0; n < in_neighbors->size; n++) {
+			node_t neighbor = in_neighbors->nodes[n];
+			cost_t new_cost = COST_ADD(dist[neighbor], state->cost[neighbor][node]);
+			if (!(flags[neighbor] & NODE_AFFECTED) && new_cost < dist[node]) {
+				dist[node] = new_cost;
+			}
+		}
+		if (dist[node] < COST_INFINITY) {
+			push_bucket_queue(queue, node, dist[node]);
+		}
+	}
+	for (int c = 0; c < state->num_changed_links; c++) {
+		changed_link_t *change = &state->changed_links[c];
+		cost_t new_cost = COST_ADD(dist[change->node], state->cost[change->node][change->neighbor]);
+		if (!(flags[change->node] & NODE_AFFECTED) && new_cost < dist[change->neighbor]) {
+			dist[change->neighbor] = new_cost;
+			push_bucket_queue(queue, change->neighbor, new_cost);
+		}
+	}
+
+	// Spread the improvements.
+	for (int d = 0; d < COST_INFINITY; d++) {
+		for (int e = queue->buckets[d]; e != -1; e = queue->entries[e].next) {
+			node_t w = queue->entries[e].node;
+			if (dist[w] != d || (flags[w] & NODE_SETTLED)) {
 				continue;
 			}
+			touch_node(state, touched, w, NODE_SETTLED);
+
+			for (int n = 0; n < state->neighbors[w].size; n++) {
+				node_t x = state->neighbors[w].nodes[n];
+				cost_t new_cost = COST_ADD(dist[w], state->cost[w][x]);
+				if (new_cost < dist[x]) {
+					dist[x] = new_cost;
+					push_bucket_queue(queue, x, new_cost);
+				}
+			}
+		}
+	}
 
-			// Update cost.
-			cost_t new_cost = COST_ADD(cost[get_current_node()][w], cost[w][x]);
-			if (new_cost < cost[get_current_node()][x]) {
-				cost[get_current_node()][x] = new_cost;
-				pred[x] = w;
+	// Nodes next to a changed distance may pick another predecessor.
+	for (int t = 0; t < touched->size; t++) {
+		node_t node = touched->nodes[t];
+		if (flags[node] & (NODE_AFFECTED | NODE_SETTLED)) {
+			changed = true;
+			for (int n = 0; n < state->neighbors[node].size; n++) {
+				touch_node(state, touched, state->neighbors[node].nodes[n], 0);
 			}
 		}
 	}
+	for (int t = 0; t < touched->size; t++) {
+		node_t node = touched->nodes[t];
+		node_t best = -1;
+		if (node != current_node && dist[node] < COST_INFINITY) {
+			node_list_t *in_neighbors = &state->in_neighbors[node];
+			for (int n = 0; n < in_neighbors->size; n++) {
+				node_t neighbor = in_neighbors->nodes[n];
+				if (COST_ADD(dist[neighbor], state->cost[neighbor][node]) == dist[node] &&
+				    (best < 0 || dist[neighbor] < dist[best] || (dist[neighbor] == dist[best] && neighbor < best))) {
+					best = neighbor;
+				}
+			}
+		}
+		if (best != pred[node]) {
+			changed = true;
+			set_pred(state, node, best);
+		}
+	}
 
-	// Update nodes.
-	for (int n = 0; n < size; n++) {
-		node_t node = tree[n];
-		node_t via = get_via(cost, pred, node);
+	// Update next hops, and those of the nodes under them that changed.
+	for (int t = 0; t < touched->size; t++) {
+		node_t node = touched->nodes[t];
+		node_t via = pred[node] < 0 ? -1 : pred[node] == current_node ? node : state->next_hop[pred[node]];
+		if (node == current_node || via == state->next_hop[node]) {
+			continue;
+		}
+
+		changed = true;
+		state->next_hop[node] = via;
+		add_to_list(stack, node);
+		while (stack->size) {
+			node_t parent = stack->nodes[--stack->size];
+			for (node_t child = state->first_child[parent]; child >= 0; child = state->next_sibling[child]) {
+				if (state->next_hop[child] != via) {
+					state->next_hop[child] = via;
+					touch_node(state, touched, child, 0);
+					add_to_list(stack, child);
+				}
+			}
+		}
+	}
+
+	// Update nodes, as in dijkstra.
+	for (int t = 0; t < touched->size; t++) {
+		node_t node = touched->nodes[t];
+		node_t via = state->next_hop[node];
+		flags[node] = 0;
 
 		// Already up to date.
-		if (node == get_current_node() || (state->cost[get_current_node()][node] == cost[get_current_node()][node] && state->via[node] == via)) {
+		if (node == current_node || (state->cost[current_node][node] == dist[node] && state->via[node] == via)) {
 			continue;
 		}
 
 		// Update via and set route.
 		state->via[node] = via;
-		set_route(node, via, cost[get_current_node()][node]);
+		set_route(node, via, dist[node]);
+	}
+
+	state->num_changed_links = 0;
+	return changed;
+}
+
+// Bring the shortest path tree and routes up to date with the link state
+// database. Rebuild the tree when there is none yet, or when links cost zero,
+// where dijkstra's ties depend on the order nodes join the tree.
+void update_routes() {
+	state_t *state = (state_t *)get_state();
+	if (!state->has_tree || state->num_zero_links) {
+		dijkstra();
+		add_counter(state->full_spf_runs, 1);
+	} else if (update_shortest_path_tree()) {
+		add_counter(state->incremental_spf_runs, 1);
+	} else {
+		add_counter(state->skipped_spf_runs, 1);
+	}
+}
+
+// Allocate the node's state, with no links.
+state_t *create_state() {
+	state_t *state = (state_t *)calloc(1, sizeof(state_t));
+	state->full_spf_runs = get_counter("full SPF runs");
+	state->incremental_spf_runs = get_counter("incremental SPF runs");
+	state->skipped_spf_runs = get_counter("skipped SPF runs");
+
+	node_t num_nodes = get_node_count();
+	state->cost = (cost_t **)malloc(sizeof(cost_t *) * num_nodes);
+	state->cost[0] = (cost_t *)malloc(sizeof(cost_t) * num_nodes * num_nodes);
+	memset(state->cost[0], COST_INFINITY, sizeof(cost_t) * num_nodes * num_nodes);
+	for (node_t node = 1; node < num_nodes; node++) {
+		state->cost[node] = state->cost[0] + (size_t)node * num_nodes;
+	}
+	for (node_t node = 0; node < num_nodes; node++) {
+		state->cost[node][node] = 0;
 	}
+	state->via = (node_t *)calloc(num_nodes, sizeof(node_t));
+	state->version = (int *)calloc(num_nodes, sizeof(int));
+	state->neighbors = (node_list_t *)calloc(num_nodes, sizeof(node_list_t));
+	state->in_neighbors = (node_list_t *)calloc(num_nodes, sizeof(node_list_t));
+
+	state->dist = (cost_t *)malloc(sizeof(cost_t) * num_nodes);
+	state->pred = (node_t *)malloc(sizeof(node_t) * num_nodes);
+	state->next_hop = (node_t *)malloc(sizeof(node_t) * num_nodes);
+	state->first_child = (node_t *)malloc(sizeof(node_t) * num_nodes);
+	state->next_sibling = (node_t *)malloc(sizeof(node_t) * num_nodes);
+	state->prev_sibling = (node_t *)malloc(sizeof(node_t) * num_nodes);
+	state->changed_links = (changed_link_t *)malloc(sizeof(changed_link_t) * MAX_CHANGED_LINKS(num_nodes));
+	state->flags = (uint8_t *)calloc(num_nodes, sizeof(uint8_t));
+	state->record_cost = (cost_t *)malloc(sizeof(cost_t) * num_nodes);
+	memset(state->record_cost, COST_INFINITY, sizeof(cost_t) * num_nodes);
+
+	init_bucket_queue(&state->queue, num_nodes > 0 ? num_nodes : 1);
+	state->in_tree = (bool *)malloc(sizeof(bool) * num_nodes);
+	state->tree = (node_t *)malloc(sizeof(node_t) * num_nodes);
+	state->bucket = (node_t *)malloc(sizeof(node_t) * num_nodes);
+
+	return state;
 }
 
 // Handler for the node to allocate and initialize its state.
 void *init_state() {
-	state_t *state = (state_t *)calloc(1, sizeof(state_t));
+	state_t *state = create_state();
 
 	// Initialize versions.
 	// Current node gets version 1, all other nodes get version 0.
@@ -185,62 +634,126 @@ void *init_state() {
 		state->via[node] = -1;
 	}
 
-	// Initialize costs for current node.
-	for (node_t node = get_first_node(); node <= get_last_node(); node = get_next_node(node)) {
-		state->cost[get_current_node()][node] = get_link_cost(node);
+	// Initialize costs for current node, from its links. Costs for all other
+	// nodes start at COST_INFINITY.
+	const link_t *links;
+	int num_links = get_links(&links);
+	for (int l = 0; l < num_links; l++) {
+		set_link_cost(state, get_current_node(), links[l].neighbor, links[l].cost);
 	}
 
-	// Initialize costs for all other nodes.
-	for (node_t node1 = get_first_node(); node1 <= get_last_node(); node1 = get_next_node(node1)) {
-		if (node1 == get_current_node()) {
-			continue;
-		}
-		for (node_t node2 = get_first_node(); node2 <= get_last_node(); node2 = get_next_node(node2)) {
-			state->cost[node1][node2] = COST_INFINITY;
+	return state;
+}
+
+// Serialized state: the link costs of every node, then via and versions.
+// The shortest path tree is rebuilt on the first run after restoring.
+int state_size() { return sizeof(cost_t) * get_node_count() * get_node_count() + (sizeof(node_t) + sizeof(int)) * get_node_count(); }
+
+void serialize_state(void *buffer) {
+	state_t *state = (state_t *)get_state();
+	node_t num_nodes = get_node_count();
+
+	char *data = (char *)buffer;
+	memcpy(data, state->cost[0], sizeof(cost_t) * num_nodes * num_nodes);
+	data += sizeof(cost_t) * num_nodes * num_nodes;
+	memcpy(data, state->via, sizeof(node_t) * num_nodes);
+	data += sizeof(node_t) * num_nodes;
+	memcpy(data, state->version, sizeof(int) * num_nodes);
+}
+
+void *deserialize_state(const void *buffer, int size) {
+	state_t *state = create_state();
+	node_t num_nodes = get_node_count();
+
+	const cost_t *cost = (const cost_t *)buffer;
+	for (node_t node1 = 0; node1 < num_nodes; node1++) {
+		for (node_t node2 = 0; node2 < num_nodes; node2++) {
+			set_link_cost(state, node1, node2, cost[(size_t)node1 * num_nodes + node2]);
 		}
 	}
 
+	const char *data = (const char *)buffer + sizeof(cost_t) * num_nodes * num_nodes;
+	memcpy(state->via, data, sizeof(node_t) * num_nodes);
+	data += sizeof(node_t) * num_nodes;
+	memcpy(state->version, data, sizeof(int) * num_nodes);
+
 	return state;
 }
 
 // Notify a node that a neighboring link has changed cost.
 void notify_link_change(node_t neighbor, cost_t new_cost) {
 	state_t *state = (state_t *)get_state();
+	node_t current_node = get_current_node();
+	cost_t old_cost = state->cost[current_node][neighbor];
 
 	// Update cost and increment version.
-	state->cost[get_current_node()][neighbor] = new_cost;
-	state->version[get_current_node()]++;
+	set_link_cost(state, current_node, neighbor, new_cost);
+	state->version[current_node]++;
+
+	// Recompute routes.
+	update_routes();
+
+	// Coalesced messages replace each other, so each must hold every record.
+	if (get_coalesce_messages()) {
+		send_database(state, -1);
+		return;
+	}
 
-	// Recompute routes and send message to neighbors.
-	dijkstra();
-	send_messages();
+	// Flood the node's new record, and bring a neighbor whose link came up
+	// up to date with every record.
+	node_list_t nodes = {&current_node, 1, 1};
+	if (old_cost == COST_INFINITY && new_cost < COST_INFINITY) {
+		send_records(state, &nodes, neighbor);
+		send_database(state, neighbor);
+	} else {
+		send_records(state, &nodes, -1);
+	}
 }
 
 // Receive a message sent by a neighboring node.
 void notify_receive_message(node_t sender, message_t message) {
 	state_t *state = (state_t *)get_state();
-	data_t *data = (data_t *)message.data;
+	cost_t *record_cost = state->record_cost;
+	node_list_t changed = {NULL, 0, 0};
 
-	bool changed = false;
+	record_t *end = (record_t *)((char *)message.data + message.size);
+	for (record_t *record = (record_t *)message.data; record < end; record = next_record(record)) {
+		node_t node = record->node;
 
-	for (node_t node1 = get_first_node(); node1 <= get_last_node(); node1 = get_next_node(node1)) {
 		// Don't recompute routes as the version is outdated.
-		if (data->ls[node1].version <= state->version[node1]) {
+		if (record->version <= state->version[node]) {
 			continue;
 		}
 
-		// Copy new version of routes.
-		state->version[node1] = data->ls[node1].version;
-		for (node_t node2 = get_first_node(); node2 <= get_last_node(); node2 = get_next_node(node2)) {
-			state->cost[node1][node2] = data->ls[node1].link_cost[node2];
+		// Copy new version of links. Links missing from the record are down,
+		// and taking one down moves the last neighbor in its place.
+		state->version[node] = record->version;
+		link_t *links = record_links(record);
+		for (int l = 0; l < record->num_links; l++) {
+			record_cost[links[l].neighbor] = links[l].cost;
+		}
+		node_list_t *neighbors = &state->neighbors[node];
+		for (int n = neighbors->size - 1; n >= 0; n--) {
+			if (record_cost[neighbors->nodes[n]] == COST_INFINITY) {
+				set_link_cost(state, node, neighbors->nodes[n], COST_INFINITY);
+			}
+		}
+		for (int l = 0; l < record->num_links; l++) {
+			set_link_cost(state, node, links[l].neighbor, links[l].cost);
+			record_cost[links[l].neighbor] = COST_INFINITY;
 		}
 
-		changed = true;
+		add_to_list(&changed, node);
 	}
 
-	// Recompute routes and send message to neighbors.
-	if (changed) {
-		dijkstra();
-		send_messages();
+	// Recompute routes and flood the new records, except back to the sender.
+	if (changed.size) {
+		update_routes();
+		if (get_coalesce_messages()) {
+			send_database(state, -1);
+		} else {
+			send_records(state, &changed, sender);
+		}
 	}
+	free(changed.nodes);
 }
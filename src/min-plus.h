@@ -0,0 +1,65 @@
+/******************************************************************************\
+* Saturating min-plus kernel, for distance vector routers.                     *
+*                                                                              *
+* Costs are bytes that saturate at COST_INFINITY, 255, so a whole distance     *
+* vector is relaxed 32 or 16 nodes at a time with AVX2 or SSE2 unsigned        *
+* saturating adds and minimums, when built for them, else one at a time.       *
+* Include after routing-simulator.h.                                           *
+\******************************************************************************/
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+// Set via[y] = neighbor for each bit y set in lower, from node first.
+static inline void set_lower_via(node_t *via, node_t first, unsigned lower, node_t neighbor) {
+	while (lower) {
+		via[first + __builtin_ctz(lower)] = neighbor;
+		lower &= lower - 1;
+	}
+}
+
+// Relax the costs through a neighbor, at link_cost from the current node with
+// distance vector dv, for the num_nodes first nodes:
+// cost[y] = min{ cost[y], link_cost + dv[y] }
+// Nodes whose cost gets strictly lower go via the neighbor, so ties stay with
+// the neighbors relaxed first.
+static inline void min_plus_row(cost_t *cost, node_t *via, const cost_t *dv, cost_t link_cost, node_t neighbor, node_t num_nodes) {
+	node_t y = 0;
+
+#if defined(__AVX2__)
+	__m256i link_cost_32 = _mm256_set1_epi8((char)link_cost);
+	for (; y + 32 <= num_nodes; y += 32) {
+		__m256i old_cost = _mm256_loadu_si256((const __m256i *)(cost + y));
+		__m256i new_cost = _mm256_adds_epu8(link_cost_32, _mm256_loadu_si256((const __m256i *)(dv + y)));
+		__m256i min_cost = _mm256_min_epu8(old_cost, new_cost);
+		unsigned lower = ~(unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(min_cost, old_cost));
+		if (lower) {
+			_mm256_storeu_si256((__m256i *)(cost + y), min_cost);
+			set_lower_via(via, y, lower, neighbor);
+		}
+	}
+#endif
+
+#if defined(__SSE2__)
+	__m128i link_cost_16 = _mm_set1_epi8((char)link_cost);
+	for (; y + 16 <= num_nodes; y += 16) {
+		__m128i old_cost = _mm_loadu_si128((const __m128i *)(cost + y));
+		__m128i new_cost = _mm_adds_epu8(link_cost_16, _mm_loadu_si128((const __m128i *)(dv + y)));
+		__m128i min_cost = _mm_min_epu8(old_cost, new_cost);
+		unsigned lower = ~(unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(min_cost, old_cost)) & 0xffff;
+		if (lower) {
+			_mm_storeu_si128((__m128i *)(cost + y), min_cost);
+			set_lower_via(via, y, lower, neighbor);
+		}
+	}
+#endif
+
+	for (; y < num_nodes; y++) {
+		cost_t new_cost = COST_ADD(link_cost, dv[y]);
+		if (new_cost < cost[y]) {
+			cost[y] = new_cost;
+			via[y] = neighbor;
+		}
+	}
+}
@@ -0,0 +1,82 @@
+/******************************************************************************\
+* Convert a .net text topology file to the binary topology format.             *
+*                                                                              *
+* Usage: net2bin <topology.net> <topology.bin>                                 *
+\******************************************************************************/
+
+#include "topology-format.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <set>
+#include <sstream>
+#include <vector>
+
+#define COST_INFINITY 255
+
+int main(int argc, char *argv[]) {
+	if (argc != 3) {
+		std::cerr << "Usage: " << argv[0] << " <topology.net> <topology.bin>" << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	std::ifstream input(argv[1]);
+	if (!input.is_open()) {
+		std::cerr << "Error opening topology file: " << argv[1] << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	std::vector<topology_record_t> records;
+	std::vector<topology_node_t> node_order;
+	std::set<topology_node_t> known_nodes;
+
+	// Parse lines, with the same rules as the simulator.
+	std::string line;
+	while (std::getline(input, line)) {
+		std::istringstream iss(line);
+		int32_t time, first_node, second_node;
+		unsigned cost_int; // Used to read cost as a number and not a char.
+		if (!(iss >> time >> first_node >> second_node >> cost_int) || first_node < 0 || second_node < 0) {
+			std::cerr << "Syntax error in topology file." << std::endl;
+			return EXIT_FAILURE;
+		}
+
+		topology_record_t record;
+		memset(&record, 0, sizeof(record));
+		record.time = time;
+		record.first_node = first_node;
+		record.second_node = second_node;
+		record.cost = cost_int > COST_INFINITY ? COST_INFINITY : cost_int;
+		records.push_back(record);
+
+		// Keep nodes in order of first appearance, the simulator colors them in that order.
+		for (topology_node_t node : {first_node, second_node}) {
+			if (known_nodes.insert(node).second) {
+				node_order.push_back(node);
+			}
+		}
+	}
+
+	// Order records by time, keeping file order within an epoch.
+	std::stable_sort(records.begin(), records.end(), [](const topology_record_t &a, const topology_record_t &b) { return a.time < b.time; });
+
+	topology_header_t header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, TOPOLOGY_MAGIC, sizeof(header.magic));
+	header.node_count = node_order.size();
+	header.record_count = records.size();
+
+	std::ofstream output(argv[2], std::ios::binary);
+	output.write((const char *)&header, sizeof(header));
+	output.write((const char *)node_order.data(), sizeof(topology_node_t) * node_order.size());
+	output.write((const char *)records.data(), sizeof(topology_record_t) * records.size());
+	if (!output) {
+		std::cerr << "Error writing binary topology file: " << argv[2] << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
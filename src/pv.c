@@ -3,6 +3,7 @@
 \******************************************************************************/
 
 #include <assert.h>
+#include <limits.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -17,16 +18,80 @@ typedef struct {
 	size_t length;
 } entry_t;
 
-// Message format to send between nodes.
-typedef struct {
-	entry_t *entry;
-} data_t;
+// Message format to send between nodes, shared by all neighbors: for each
+// node, the offset of its path, with one more offset past the last path, then
+// the paths, back to back, then the cost to each node.
+// The path to node y is nodes offsets[y] to offsets[y + 1] - 1.
+node_t *path_offsets(void *data) { return (node_t *)data; }
+
+node_t *path_nodes(void *data) { return path_offsets(data) + get_node_count() + 1; }
+
+cost_t *path_costs(void *data) { return (cost_t *)(path_nodes(data) + path_offsets(data)[get_node_count()]); }
 
 // State format.
+// Entries of the current node and its neighbors, get_node_count() each. The
+// other nodes never send any, so they share one row of empty entries.
+// The current node's paths are buffers of their own, of their length, and the
+// neighbors' ones point into a buffer per neighbor with all of their paths.
 typedef struct {
 	entry_t **entries;
+	node_t **paths;
 } state_t;
 
+// Resize the path of an entry to length nodes.
+void resize_path(entry_t *entry, size_t length) {
+	if (length == 0) {
+		free(entry->path);
+		entry->path = NULL;
+	} else if (length != entry->length) {
+		entry->path = (node_t *)realloc(entry->path, sizeof(node_t) * length);
+	}
+	entry->length = length;
+}
+
+// Set the paths of sender's entries from a buffer of offsets and paths, in
+// the message format, copying them into sender's buffer.
+void set_paths(state_t *state, node_t sender, const node_t *offsets, const node_t *nodes) {
+	size_t total_length = offsets[get_node_count()];
+	state->paths[sender] = (node_t *)realloc(state->paths[sender], sizeof(node_t) * (total_length > 0 ? total_length : 1));
+	memcpy(state->paths[sender], nodes, sizeof(node_t) * total_length);
+
+	entry_t *entries = state->entries[sender];
+	for (node_t node = get_first_node(); node <= get_last_node(); node = get_next_node(node)) {
+		entries[node].path = state->paths[sender] + offsets[node];
+		entries[node].length = offsets[node + 1] - offsets[node];
+	}
+}
+
+// Allocate the state's rows, with every entry empty and no path.
+state_t *create_state() {
+	state_t *state = (state_t *)malloc(sizeof(state_t));
+	node_t num_nodes = get_node_count();
+	state->entries = (entry_t **)malloc(sizeof(entry_t *) * num_nodes);
+	state->paths = (node_t **)calloc(num_nodes, sizeof(node_t *));
+
+	entry_t *unknown = (entry_t *)malloc(sizeof(entry_t) * num_nodes);
+	for (node_t node = 0; node < num_nodes; node++) {
+		unknown[node].cost = COST_INFINITY;
+		unknown[node].path = NULL;
+		unknown[node].length = 0;
+	}
+	for (node_t node = get_first_node(); node <= get_last_node(); node = get_next_node(node)) {
+		state->entries[node] = unknown;
+	}
+
+	// The current node and neighbors get rows of their own.
+	const link_t *links;
+	int num_links = get_links(&links);
+	for (int l = -1; l < num_links; l++) {
+		node_t node = l < 0 ? get_current_node() : links[l].neighbor;
+		state->entries[node] = (entry_t *)malloc(sizeof(entry_t) * num_nodes);
+		memcpy(state->entries[node], unknown, sizeof(entry_t) * num_nodes);
+	}
+
+	return state;
+}
+
 // Detect loops in the path.
 bool is_loop(node_t via, node_t to) {
 	state_t *state = (state_t *)get_state();
@@ -49,6 +114,8 @@ bool bellman_ford() {
 	bool changed = false;
 	cost_t min_cost;
 	node_t via;
+	const link_t *links;
+	int num_links = get_links(&links);
 
 	// D_x(y) = min { D_x(y), c(x,z) + D_z(y) }
 	for (node_t y = get_first_node(); y <= get_last_node(); y = get_next_node(y)) {
@@ -58,45 +125,57 @@ bool bellman_ford() {
 
 		min_cost = get_link_cost(y);
 		via = y;
-
-		// Find the minimum cost to reach y, and the neighbor that allows it.
-		for (node_t z = get_first_node(); z <= get_last_node(); z = get_next_node(z)) {
-			if (z == get_current_node() || z == y) {
+		size_t min_length = 1;
+
+		// Find the minimum cost to reach y, and the neighbor that allows it,
+		// through a path without the current node. Equal costs go to the
+		// shortest path, so that zero cost links still make every path less
+		// preferred than its suffixes, or nodes could keep switching between
+		// each other's equal cost paths.
+		for (int l = 0; l < num_links; l++) {
+			node_t z = links[l].neighbor;
+			if (z == y) {
 				continue;
 			}
-			if (COST_ADD(get_link_cost(z), state->entries[z][y].cost) < min_cost && !is_loop(z, y)) {
-				min_cost = COST_ADD(get_link_cost(z), state->entries[z][y].cost);
+			cost_t cost = COST_ADD(links[l].cost, state->entries[z][y].cost);
+			size_t length = 1 + state->entries[z][y].length;
+			if ((cost < min_cost || (cost == min_cost && cost != COST_INFINITY && length < min_length)) && !is_loop(z, y)) {
+				min_cost = cost;
+				min_length = length;
 				via = z;
 			}
 		}
 
-		// If min_cost is different from the path vector value, update it.
-		// If via is different from the previous via, update it, but signal no changes in the path vector.
-		bool changed_dv = min_cost != state->entries[get_current_node()][y].cost;
-		bool changed_via = state->entries[get_current_node()][y].path[0] != via && state->entries[get_current_node()][y].cost != COST_INFINITY;
-		if (changed_dv || changed_via) {
+		// If min_cost, via or via's path to y is different from the path
+		// vector's path, update it. Via's path can change at the same cost,
+		// e.g. over zero cost links, and keeping the old one would let loops
+		// through is_loop.
+		entry_t *entry = &state->entries[get_current_node()][y];
+		bool changed_dv = min_cost != entry->cost;
+		bool changed_path = false;
+		if (!changed_dv && min_cost != COST_INFINITY) {
+			changed_path = entry->length != min_length || entry->path[0] != via || (via != y && memcmp(entry->path + 1, state->entries[via][y].path, sizeof(node_t) * (min_length - 1)) != 0);
+		}
+		if (changed_dv || changed_path) {
 			changed = true;
 
 			// Update cost.
-			state->entries[get_current_node()][y].cost = min_cost;
+			entry->cost = min_cost;
 			set_route(y, via, min_cost);
 
 			// If cost is COST_INFINITY, there's no path.
 			if (min_cost == COST_INFINITY) {
-				state->entries[get_current_node()][y].length = 0;
+				resize_path(entry, 0);
 				continue;
 			}
 
 			// Copy path and set path length.
 			// Path starts with via.
-			size_t path_size = 0;
-			state->entries[get_current_node()][y].path[path_size++] = via;
+			resize_path(entry, min_length);
+			entry->path[0] = via;
 			if (via != y) {
-				for (size_t i = 0; i < state->entries[via][y].length; i++) {
-					state->entries[get_current_node()][y].path[path_size++] = state->entries[via][y].path[i];
-				}
+				memcpy(entry->path + 1, state->entries[via][y].path, sizeof(node_t) * (min_length - 1));
 			}
-			state->entries[get_current_node()][y].length = path_size;
 		}
 	}
 
@@ -107,77 +186,133 @@ bool bellman_ford() {
 void send_messages() {
 	state_t *state = (state_t *)get_state();
 
-	for (node_t neighbor = get_first_node(); neighbor <= get_last_node(); neighbor = get_next_node(neighbor)) {
-		// Send message only to neighbors.
-		if (neighbor == get_current_node() || get_link_cost(neighbor) == COST_INFINITY) {
-			continue;
-		}
+	entry_t *entries = state->entries[get_current_node()];
+	node_t num_nodes = get_node_count();
 
-		// Create message.
-		message_t message;
-		message.data = (data_t *)malloc(sizeof(data_t));
-		message.size = sizeof(message.data);
+	// Size the paths.
+	size_t total_length = 0;
+	for (node_t node = get_first_node(); node <= get_last_node(); node = get_next_node(node)) {
+		total_length += entries[node].length;
+	}
 
-		// Allocate memory.
-		data_t *data = (data_t *)message.data;
-		data->entry = (entry_t *)malloc(sizeof(entry_t) * MAX_NODES);
-		for (node_t node = 0; node <= get_last_node(); node = get_next_node(node)) {
-			data->entry[node].path = (node_t *)malloc(sizeof(node_t) * MAX_NODES);
-		}
+	// Create message, shared by all neighbors. Its size, and so the offsets
+	// in it, must fit in an int.
+	size_t size = sizeof(node_t) * (num_nodes + 1 + total_length) + sizeof(cost_t) * num_nodes;
+	assert(size <= INT_MAX && "Path vector too large for a message.");
+	message_t message = create_message(size);
 
-		// Copy entries.
-		memcpy(data->entry, state->entries[get_current_node()], sizeof(entry_t) * MAX_NODES);
+	// Set offsets from the path lengths, empty for IDs without a node.
+	node_t *offsets = path_offsets(message.data);
+	memset(offsets, 0, sizeof(node_t) * (num_nodes + 1));
+	for (node_t node = get_first_node(); node <= get_last_node(); node = get_next_node(node)) {
+		offsets[node + 1] = entries[node].length;
+	}
+	for (node_t node = 0; node < num_nodes; node++) {
+		offsets[node + 1] += offsets[node];
+	}
 
-		send_message(neighbor, message);
+	// Copy paths and costs.
+	node_t *nodes = path_nodes(message.data);
+	cost_t *costs = path_costs(message.data);
+	memset(costs, COST_INFINITY, sizeof(cost_t) * num_nodes);
+	for (node_t node = get_first_node(); node <= get_last_node(); node = get_next_node(node)) {
+		memcpy(nodes + offsets[node], entries[node].path, sizeof(node_t) * entries[node].length);
+		costs[node] = entries[node].cost;
 	}
+
+	broadcast_message(message);
+	release_message(message);
 }
 
 // Handler for the node to allocate and initialize its state.
 void *init_state() {
-	state_t *state = (state_t *)malloc(sizeof(state_t));
-
-	// Allocate memory.
-	state->entries = (entry_t **)malloc(sizeof(entry_t *) * MAX_NODES);
-	for (node_t node1 = get_first_node(); node1 <= get_last_node(); node1 = get_next_node(node1)) {
-		state->entries[node1] = (entry_t *)malloc(sizeof(entry_t) * MAX_NODES);
-		for (node_t node2 = get_first_node(); node2 <= get_last_node(); node2 = get_next_node(node2)) {
-			state->entries[node1][node2].path = (node_t *)malloc(sizeof(node_t) * MAX_NODES);
-		}
-	}
+	state_t *state = create_state();
 
 	// Initialize path vector.
 	for (node_t node = get_first_node(); node <= get_last_node(); node = get_next_node(node)) {
 		// Set cost.
 		state->entries[get_current_node()][node].cost = get_link_cost(node);
 
-		// Current node is the only one in the path.
-		if (node == get_current_node()) {
-			state->entries[get_current_node()][node].length = 0;
-			continue;
+		// Path to neighbor is myself + neighbor. Other nodes, and the current
+		// node itself, get empty paths.
+		if (node != get_current_node() && get_link_cost(node) != COST_INFINITY) {
+			resize_path(&state->entries[get_current_node()][node], 1);
+			state->entries[get_current_node()][node].path[0] = node;
 		}
+	}
 
-		if (get_link_cost(node) == COST_INFINITY) {
-			// Not neighbor, so the path is empty.
-			state->entries[get_current_node()][node].length = 0;
+	return state;
+}
 
-		} else {
-			// Path to neighbor is myself + neighbor
-			state->entries[get_current_node()][node].path[0] = node;
-			state->entries[get_current_node()][node].length = 1;
+// Serialized state: the rows of the current node, then of each neighbor in
+// link order, with every entry's cost, path length and path.
+int state_size() {
+	state_t *state = (state_t *)get_state();
+	const link_t *links;
+	int num_links = get_links(&links);
+
+	size_t size = 0;
+	for (int l = -1; l < num_links; l++) {
+		entry_t *entries = state->entries[l < 0 ? get_current_node() : links[l].neighbor];
+		for (node_t node = get_first_node(); node <= get_last_node(); node = get_next_node(node)) {
+			size += sizeof(node_t) * (2 + entries[node].length);
 		}
 	}
 
-	// Initialize the path vector of the other nodes.
-	// Each one gets a cost of COST_INFINITY and a path length of 0.
-	for (node_t node1 = get_first_node(); node1 <= get_last_node(); node1 = get_next_node(node1)) {
-		if (node1 == get_current_node()) {
-			continue;
+	assert(size <= INT_MAX && "State too large for a checkpoint.");
+	return size;
+}
+
+void serialize_state(void *buffer) {
+	state_t *state = (state_t *)get_state();
+	const link_t *links;
+	int num_links = get_links(&links);
+
+	node_t *data = (node_t *)buffer;
+	for (int l = -1; l < num_links; l++) {
+		entry_t *entries = state->entries[l < 0 ? get_current_node() : links[l].neighbor];
+		for (node_t node = get_first_node(); node <= get_last_node(); node = get_next_node(node)) {
+			*data++ = entries[node].cost;
+			*data++ = entries[node].length;
+			memcpy(data, entries[node].path, sizeof(node_t) * entries[node].length);
+			data += entries[node].length;
 		}
-		for (node_t node2 = get_first_node(); node2 <= get_last_node(); node2 = get_next_node(node2)) {
-			state->entries[node1][node2].cost = COST_INFINITY;
-			state->entries[node1][node2].length = 0;
+	}
+}
+
+void *deserialize_state(const void *buffer, int size) {
+	state_t *state = create_state();
+	node_t num_nodes = get_node_count();
+	const link_t *links;
+	int num_links = get_links(&links);
+
+	// Restore the current node's entries.
+	const node_t *data = (const node_t *)buffer;
+	entry_t *entries = state->entries[get_current_node()];
+	for (node_t node = get_first_node(); node <= get_last_node(); node = get_next_node(node)) {
+		entries[node].cost = *data++;
+		resize_path(&entries[node], *data++);
+		memcpy(entries[node].path, data, sizeof(node_t) * entries[node].length);
+		data += entries[node].length;
+	}
+
+	// Restore the neighbors' entries, gathering their paths as in a message.
+	node_t *offsets = (node_t *)calloc(num_nodes + 1, sizeof(node_t));
+	node_t *nodes = (node_t *)malloc(size);
+	for (int l = 0; l < num_links; l++) {
+		entries = state->entries[links[l].neighbor];
+		memset(offsets, 0, sizeof(node_t) * (num_nodes + 1));
+		for (node_t node = get_first_node(); node <= get_last_node(); node = get_next_node(node)) {
+			entries[node].cost = *data++;
+			node_t length = *data++;
+			memcpy(nodes + offsets[node], data, sizeof(node_t) * length);
+			data += length;
+			offsets[node + 1] = offsets[node] + length;
 		}
+		set_paths(state, links[l].neighbor, offsets, nodes);
 	}
+	free(offsets);
+	free(nodes);
 
 	return state;
 }
@@ -198,8 +333,12 @@ void notify_receive_message(node_t sender, message_t message) {
 	state_t *state = (state_t *)get_state();
 
 	// Copy new path vector from message to state.
-	data_t *data = (data_t *)message.data;
-	memcpy(state->entries[sender], data->entry, sizeof(entry_t) * MAX_NODES);
+	const cost_t *costs = path_costs(message.data);
+	entry_t *entries = state->entries[sender];
+	for (node_t node = get_first_node(); node <= get_last_node(); node = get_next_node(node)) {
+		entries[node].cost = costs[node];
+	}
+	set_paths(state, sender, path_offsets(message.data), path_nodes(message.data));
 
 	// Recompute path vector.
 	bool changed = bellman_ford();
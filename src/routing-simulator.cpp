@@ -6,15 +6,39 @@
 \******************************************************************************/
 
 #include "routing-simulator.h"
+#include "topology-format.h"
+#include "trace-format.h"
 
 #include <assert.h>
+#include <fcntl.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
 #include <fstream>
+#include <iomanip>
 #include <iostream>
+#include <limits>
 #include <map>
+#include <mutex>
+#include <new>
 #include <set>
 #include <sstream>
+#include <thread>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
 
 // Initial set of node colors. Subsequent colors chosen randomly.
 static std::map<node_t, std::string> colors = {
@@ -30,6 +54,15 @@ static node_t show_routes_for = -1;
 static long max_events = -1;
 // Flag to output each step, or only one per epoch.
 static bool epoch_steps = false;
+// Number of threads to run each epoch's messages on.
+static int num_threads = 1;
+// Flag to replace a message still pending on the same link, instead of adding another.
+static bool coalesce_messages = false;
+// Checkpoint to save before the first event of an epoch.
+static event_time_t checkpoint_epoch = -1;
+static std::string checkpoint_file_name;
+// Name of the simulator, checkpoints are only restored by the one that saved them.
+static std::string simulator_name;
 
 enum event_type_t { LINK_CHANGE, MESSAGE };
 typedef struct {
@@ -51,264 +84,1699 @@ typedef struct {
 	};
 } event_t;
 
-// Ordered sequence of events to process.
-static std::multimap<event_time_t, event_t> events;
+// Header in front of every message buffer, counting references to it.
+// Aligned so that the message data that follows it is suitably aligned.
+// Messages in an epoch arena aren't counted, they die with the arena, and only
+// retained ones are copied onto the heap.
+typedef struct alignas(std::max_align_t) message_header {
+	std::atomic<int> references;
+	bool in_arena;
+} message_header_t;
+
+// Bump allocator for memory that only has to live until the end of the next
+// epoch: payloads of messages in flight.
+// Each thread has two arenas, used on alternate epochs. The one for an epoch
+// is reset as the epoch starts, since all messages sent two epochs ago have
+// been delivered by then.
+#define ARENA_CHUNK_SIZE (1 << 20)
+typedef struct {
+	std::vector<std::pair<char *, size_t>> chunks;
+	size_t chunk;
+	size_t used;
+} arena_t;
+// Arena pairs of every thread.
+static std::vector<arena_t *> arenas;
+static std::mutex arenas_mutex;
+static thread_local arena_t *thread_arenas = NULL;
+
+// Calendar queue of events to process, one bucket per epoch.
+// Link changes are all known at load time and kept sorted by time. Messages are
+// always delivered on the next epoch, so only the current and next epoch
+// buckets are needed for them. Within an epoch, link changes come first, in
+// file order, followed by messages, in send order.
+static std::vector<std::pair<event_time_t, event_t>> link_change_events;
+static size_t next_link_change = 0;
+// Events of the current epoch, and the next one to process.
+static std::vector<event_t> epoch_events;
+static size_t next_epoch_event = 0;
+static event_time_t epoch_time = -1;
+// Messages to deliver during the epoch after the current one.
+static std::vector<event_t> next_epoch_messages;
+// With coalesce_messages, each directed link's message in next_epoch_messages,
+// as <epoch it was sent in, index>, indexed like topology_links.
+#define NO_PENDING_MESSAGE std::numeric_limits<event_time_t>::min()
+static std::vector<std::pair<event_time_t, size_t>> pending_link_messages;
 // Unique set of all nodes in network.
 static std::set<node_t> nodes;
-// Network topology: map[link] -> cost.
-// Undirected graph, first node always < second.
-static std::map<std::pair<node_t, node_t>, cost_t> topology;
-// Router set routes: map[source][destination] -> <neighbor, route cost>
-static std::map<node_t, std::map<node_t, std::pair<node_t, cost_t>>> routes;
+// Network topology, as a CSR adjacency list of every link that shows up in
+// the topology file. Undirected graph, each link is stored in both nodes' rows,
+// sorted by neighbor. Links that are down cost COST_INFINITY.
+static node_t topology_size = 0;
+static std::vector<size_t> topology_offsets;
+static std::vector<link_t> topology_links;
+// Dense copy of the link costs for O(1) lookups, only kept for small networks.
+#define DENSE_TOPOLOGY_NODES 2048
+static std::vector<cost_t> topology_matrix;
+// Router set routes, as dense matrices: [source][destination] -> neighbor, and
+// [source][destination] -> route cost, COST_INFINITY where there is no route.
+// They are kept apart, as a struct of both would be padded to 8 bytes a route.
+// Handlers running in parallel only ever touch their own node's row.
+static std::vector<node_t> route_next_hops;
+static std::vector<cost_t> route_costs;
+// Nodes whose routes changed since the last snapshot, and each node's routes
+// as rendered for that snapshot. Only changed nodes are rendered again.
+static std::vector<uint8_t> dirty_route_nodes;
+static std::vector<std::string> route_dots;
 // Node black box state.
 static std::map<node_t, void *> node_states;
 
 static std::ifstream topology_file;
-static std::ofstream steps_dot_file;
-static std::ofstream final_dot_file;
 
-// Current event context.
-static node_t current_node;
+// Output file for snapshots or the trace. Output is formatted into a large
+// buffer, which is handed to a background writer thread once full, through a
+// bounded queue. Files left at /dev/null are disabled, and nothing is made
+// for them.
+#define OUTPUT_BUFFER_SIZE (1 << 20)
+#define OUTPUT_QUEUE_SIZE 8
+typedef struct {
+	bool enabled;
+	std::ofstream file;
+	std::ostringstream buffer;
+	std::deque<std::string> queue;
+	std::mutex mutex;
+	std::condition_variable queue_changed;
+	bool closing;
+	std::thread writer;
+} output_file_t;
+static output_file_t steps_dot_output;
+static output_file_t final_dot_output;
+static output_file_t trace_output;
+
+// Current event context. Each thread handles one node at a time.
+static thread_local node_t current_node;
 static event_time_t current_time = -1;
-static bool changed = false;
+static thread_local bool changed = false;
+// Where messages sent by the current handler go, when running in parallel.
+static thread_local std::vector<event_t> *outbox = NULL;
+// Where trace records of the current handler go, when running in parallel.
+static thread_local std::vector<trace_record_t> *trace_slot = NULL;
+
+// Worker threads for parallel epochs.
+// Message events of an epoch are split into per-node mailboxes. Workers take
+// whole nodes at a time, so each node's handlers still run in order, and
+// messages sent while handling each event go to that event's outbox. Outboxes
+// are merged in event order at the epoch barrier, so the next epoch sees the
+// same messages in the same order as a single-threaded run.
+static std::vector<std::thread> workers;
+static std::mutex workers_mutex;
+static std::condition_variable workers_start;
+static std::condition_variable workers_done;
+static long workers_generation = 0;
+static int workers_running = 0;
+static bool workers_exit = false;
+static std::atomic<bool> workers_changed(false);
+// Per-node mailboxes for the current epoch: indices into epoch_events.
+static std::vector<std::vector<size_t>> mailboxes;
+static std::vector<node_t> mailbox_nodes;
+static std::atomic<size_t> next_mailbox;
+// Messages sent while handling each event of the current epoch.
+static std::vector<std::vector<event_t>> event_outboxes;
+static std::vector<std::vector<trace_record_t>> event_traces;
+
+// Simulation stats
+static long num_events = 0;
+static long num_link_changes = 0;
+static long num_messages = 0;
+static long num_message_bytes = 0;
+static long num_coalesced_messages = 0;
+static std::atomic<long> num_route_changes(0);
+// Counters kept by the router module: their names, by ID, and their values,
+// added up by each thread on its own and summed for reports and checkpoints.
+static std::vector<std::string> router_counter_names;
+static std::vector<std::vector<long> *> router_counters;
+static std::mutex router_counters_mutex;
+static thread_local std::vector<long> *thread_counters = NULL;
+
+// Per-epoch stats, for --stats-csv, --stats-json and --progress.
+typedef struct {
+	long events;
+	long link_changes;
+	long messages;
+	long message_bytes;
+	long route_changes;
+	std::chrono::steady_clock::time_point time;
+} stats_totals_t;
+static output_file_t stats_csv_output;
+static output_file_t stats_json_output;
+// Seconds between progress lines on stderr, or 0 for none.
+static double progress_interval = 0;
+static std::chrono::steady_clock::time_point start_time;
+static std::chrono::steady_clock::time_point next_progress_time;
+// Totals at the start of the current epoch.
+static stats_totals_t epoch_start_totals;
+// Resident set sizes are read from the system at most every
+// RSS_SAMPLE_INTERVAL seconds, and the last ones repeated for epochs in
+// between, so that runs with many short epochs don't spend their time on it.
+#define RSS_SAMPLE_INTERVAL 0.1
+static std::chrono::steady_clock::time_point next_rss_sample_time;
+static long rss_kb_sample = 0;
+static long peak_rss_kb_sample = 0;
+
+// Find the link to neighbor in node's adjacency row, or NULL if there is none.
+static link_t *find_topology_link(node_t node, node_t neighbor) {
+	if (node < 0 || node >= topology_size) {
+		return NULL;
+	}
+
+	link_t *first = topology_links.data() + topology_offsets[node];
+	link_t *last = topology_links.data() + topology_offsets[node + 1];
+	link_t *link = std::lower_bound(first, last, neighbor, [](const link_t &link, node_t neighbor) { return link.neighbor < neighbor; });
+	return link != last && link->neighbor == neighbor ? link : NULL;
+}
+
+static cost_t get_topology_cost(node_t first_node, node_t second_node) {
+	if (first_node == second_node) {
+		return 0;
+	}
+
+	if (!topology_matrix.empty()) {
+		if (first_node < 0 || first_node >= topology_size || second_node < 0 || second_node >= topology_size) {
+			return COST_INFINITY;
+		}
+		return topology_matrix[(size_t)first_node * topology_size + second_node];
+	}
+
+	link_t *link = find_topology_link(first_node, second_node);
+	return link ? link->cost : COST_INFINITY;
+}
+
+static void set_topology_cost(node_t first_node, node_t second_node, cost_t cost) {
+	assert(first_node != second_node && "Setting cost of self-edge.");
+
+	// Update both directions of the undirected link in place.
+	link_t *link = find_topology_link(first_node, second_node);
+	link_t *reverse_link = find_topology_link(second_node, first_node);
+	assert(link && reverse_link && "Setting cost of link not in topology.");
+	link->cost = cost;
+	reverse_link->cost = cost;
+
+	if (!topology_matrix.empty()) {
+		topology_matrix[(size_t)first_node * topology_size + second_node] = cost;
+		topology_matrix[(size_t)second_node * topology_size + first_node] = cost;
+	}
+}
+
+// Build the adjacency structure from the links in the link change events.
+// All links start down.
+static void build_topology() {
+	if (nodes.empty()) {
+		topology_size = 0;
+		topology_offsets.assign(1, 0);
+		return;
+	}
+	topology_size = *nodes.rbegin() + 1;
+
+	std::vector<std::pair<node_t, node_t>> pairs;
+	pairs.reserve(link_change_events.size());
+	for (auto &event : link_change_events) {
+		if (event.second.link_change.node != event.second.link_change.neighbor) {
+			pairs.push_back(std::make_pair(event.second.link_change.node, event.second.link_change.neighbor));
+		}
+	}
+	std::sort(pairs.begin(), pairs.end());
+	pairs.erase(std::unique(pairs.begin(), pairs.end()), pairs.end());
+
+	topology_offsets.assign(topology_size + 1, 0);
+	topology_links.resize(pairs.size());
+	for (size_t l = 0; l < pairs.size(); l++) {
+		++topology_offsets[pairs[l].first + 1];
+		topology_links[l].neighbor = pairs[l].second;
+		topology_links[l].cost = COST_INFINITY;
+	}
+	for (node_t node = 0; node < topology_size; node++) {
+		topology_offsets[node + 1] += topology_offsets[node];
+	}
+
+	if (topology_size <= DENSE_TOPOLOGY_NODES) {
+		topology_matrix.assign((size_t)topology_size * topology_size, COST_INFINITY);
+	}
+}
+
+// Start every node with no routes.
+static void init_routes() {
+	route_next_hops.assign((size_t)topology_size * topology_size, -1);
+	route_costs.assign((size_t)topology_size * topology_size, COST_INFINITY);
+	dirty_route_nodes.assign(topology_size, true);
+	route_dots.assign(topology_size, std::string());
+}
+
+// Index the messages already pending for the next epoch, each on its own link.
+static void init_pending_messages() {
+	pending_link_messages.assign(topology_links.size(), std::make_pair(NO_PENDING_MESSAGE, (size_t)0));
+	for (size_t e = 0; e < next_epoch_messages.size(); e++) {
+		link_t *link = find_topology_link(next_epoch_messages[e].message.source, next_epoch_messages[e].message.destination);
+		pending_link_messages[link - topology_links.data()] = std::make_pair(epoch_time, e);
+	}
+}
+
+static void make_color(node_t node) {
+	if (!colors.count(node)) { // Generate new color if not already defined.
+		// Random hue, full saturation and value.
+		colors[node] = std::to_string((float)rand() / RAND_MAX) + " 1.0 1.0";
+	}
+}
+
+// Allocate memory from the current thread's arena for the current epoch.
+static void *arena_alloc(size_t size) {
+	if (!thread_arenas) {
+		thread_arenas = new arena_t[2]();
+		std::lock_guard<std::mutex> lock(arenas_mutex);
+		arenas.push_back(thread_arenas);
+	}
+	arena_t *arena = &thread_arenas[current_time & 1];
+
+	size = (size + alignof(std::max_align_t) - 1) & ~(alignof(std::max_align_t) - 1);
+	for (; arena->chunk < arena->chunks.size(); arena->chunk++, arena->used = 0) {
+		if (arena->used + size <= arena->chunks[arena->chunk].second) {
+			void *memory = arena->chunks[arena->chunk].first + arena->used;
+			arena->used += size;
+			return memory;
+		}
+	}
+
+	// Out of space, add a chunk.
+	size_t chunk_size = std::max((size_t)ARENA_CHUNK_SIZE, size);
+	arena->chunks.push_back(std::make_pair((char *)malloc(chunk_size), chunk_size));
+	arena->used = size;
+	return arena->chunks.back().first;
+}
+
+// Reset every thread's arena for the epoch at time.
+static void reset_arenas(event_time_t time) {
+	std::lock_guard<std::mutex> lock(arenas_mutex);
+	for (auto thread_arenas : arenas) {
+		thread_arenas[time & 1].chunk = 0;
+		thread_arenas[time & 1].used = 0;
+	}
+}
+
+// Sum the router's counters of every thread, by name. Only call it between
+// epochs, when threads don't add to them.
+static std::map<std::string, long> sum_router_counters() {
+	std::lock_guard<std::mutex> lock(router_counters_mutex);
+	std::map<std::string, long> sums;
+	for (size_t c = 0; c < router_counter_names.size(); c++) {
+		long &sum = sums[router_counter_names[c]];
+		for (auto counters : router_counters) {
+			sum += c < counters->size() ? (*counters)[c] : 0;
+		}
+	}
+	return sums;
+}
+
+// Allocate a reference-counted message on the heap, for messages that outlive
+// their epoch.
+static message_t create_heap_message(int size) {
+	message_header_t *header = (message_header_t *)malloc(sizeof(message_header_t) + size);
+	new (&header->references) std::atomic<int>(1);
+	header->in_arena = false;
+
+	message_t message;
+	message.data = header + 1;
+	message.size = size;
+	return message;
+}
+
+// Make sure the current epoch bucket has events left to process, moving on to
+// the next epoch that has any. Returns false when no events are left.
+static bool fill_epoch_events() {
+	if (next_epoch_event < epoch_events.size()) {
+		return true;
+	}
+
+	bool has_messages = !next_epoch_messages.empty();
+	bool has_link_changes = next_link_change < link_change_events.size();
+	if (!has_messages && !has_link_changes) {
+		return false;
+	}
+
+	// Pending messages are always for the epoch right after the current one.
+	event_time_t time = has_messages ? epoch_time + 1 : link_change_events[next_link_change].first;
+	if (has_link_changes && link_change_events[next_link_change].first < time) {
+		time = link_change_events[next_link_change].first;
+	}
+
+	epoch_events.clear();
+	next_epoch_event = 0;
+	for (; next_link_change < link_change_events.size() && link_change_events[next_link_change].first == time; ++next_link_change) {
+		epoch_events.push_back(link_change_events[next_link_change].second);
+	}
+	if (has_messages && time == epoch_time + 1) {
+		if (epoch_events.empty()) {
+			epoch_events.swap(next_epoch_messages);
+		} else {
+			epoch_events.insert(epoch_events.end(), next_epoch_messages.begin(), next_epoch_messages.end());
+		}
+		next_epoch_messages.clear();
+	}
+	epoch_time = time;
+	reset_arenas(time);
+	return true;
+}
+
+// Get the next event to process, or NULL if there are none left.
+static const event_t *peek_event() { return fill_epoch_events() ? &epoch_events[next_epoch_event] : NULL; }
+
+static void load_text_topology_events() {
+	std::string line;
+	// Iterate file lines.
+	while (std::getline(topology_file, line)) {
+		std::istringstream iss(line);
+		event_time_t time;
+		node_t first_node, second_node;
+		unsigned cost_int; // Used to read cost as a number and not a char.
+		// Parse line.
+		if (!(iss >> time >> first_node >> second_node >> cost_int) || first_node < 0 || second_node < 0) {
+			std::cerr << "Syntax error in topology file." << std::endl;
+			exit(EXIT_FAILURE);
+		}
+		cost_t cost = cost_int > COST_INFINITY ? COST_INFINITY : cost_int;
+
+		// Insert two link change events, one for each side of the link.
+		event_t event;
+		event.type = LINK_CHANGE;
+		event.link_change.node = first_node;
+		event.link_change.neighbor = second_node;
+		event.link_change.new_cost = cost;
+		link_change_events.push_back(std::make_pair(time, event));
+		event.link_change.node = second_node;
+		event.link_change.neighbor = first_node;
+		link_change_events.push_back(std::make_pair(time, event));
+
+		// Keep track of known nodes.
+		nodes.insert(first_node);
+		nodes.insert(second_node);
+
+		// Generate colors for the nodes, as needed.
+		make_color(first_node);
+		make_color(second_node);
+	}
+
+	// Order link changes by time, keeping file order within an epoch.
+	std::stable_sort(link_change_events.begin(), link_change_events.end(),
+	                 [](const std::pair<event_time_t, event_t> &a, const std::pair<event_time_t, event_t> &b) { return a.first < b.first; });
+}
+
+// Load a binary topology file from net2bin. It's mapped and its records,
+// already sorted by time, copied into link change events without sorting.
+static void load_binary_topology_events(const std::string &file_name) {
+	int fd = open(file_name.c_str(), O_RDONLY);
+	struct stat file_stat;
+	if (fd < 0 || fstat(fd, &file_stat) < 0) {
+		std::cerr << "Error opening topology file: " << file_name << std::endl;
+		exit(EXIT_FAILURE);
+	}
+	size_t file_size = file_stat.st_size;
+	void *file = mmap(NULL, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (file == MAP_FAILED) {
+		std::cerr << "Error opening topology file: " << file_name << std::endl;
+		exit(EXIT_FAILURE);
+	}
+	madvise(file, file_size, MADV_SEQUENTIAL);
+
+	// Check the file holds a header before reading it, and then that it
+	// holds exactly the nodes and records the header says.
+	if (file_size < sizeof(topology_header_t)) {
+		std::cerr << "Syntax error in topology file." << std::endl;
+		exit(EXIT_FAILURE);
+	}
+	const topology_header_t *header = (const topology_header_t *)file;
+	if (header->record_count > file_size / sizeof(topology_record_t) ||
+	    file_size != sizeof(topology_header_t) + sizeof(topology_node_t) * header->node_count + sizeof(topology_record_t) * header->record_count) {
+		std::cerr << "Syntax error in topology file." << std::endl;
+		exit(EXIT_FAILURE);
+	}
+	const topology_node_t *file_nodes = (const topology_node_t *)(header + 1);
+	const topology_record_t *records = (const topology_record_t *)(file_nodes + header->node_count);
+
+	// Known nodes, colored in the order the text file had them.
+	node_t last_node = -1;
+	for (uint32_t n = 0; n < header->node_count; n++) {
+		if (file_nodes[n] < 0) {
+			std::cerr << "Syntax error in topology file." << std::endl;
+			exit(EXIT_FAILURE);
+		}
+		nodes.insert(file_nodes[n]);
+		make_color(file_nodes[n]);
+		last_node = std::max(last_node, (node_t)file_nodes[n]);
+	}
+	std::vector<bool> known_nodes(last_node + 1);
+	for (uint32_t n = 0; n < header->node_count; n++) {
+		known_nodes[file_nodes[n]] = true;
+	}
+
+	// Insert two link change events per record, one for each side of the link.
+	link_change_events.resize(2 * header->record_count);
+	for (uint64_t r = 0; r < header->record_count; r++) {
+		const topology_record_t &record = records[r];
+		// Every node in a record must be one of the known nodes, as the text
+		// file had them all.
+		if (record.first_node < 0 || record.first_node > last_node || !known_nodes[record.first_node] || record.second_node < 0 ||
+		    record.second_node > last_node || !known_nodes[record.second_node] || (r > 0 && record.time < records[r - 1].time)) {
+			std::cerr << "Syntax error in topology file." << std::endl;
+			exit(EXIT_FAILURE);
+		}
+
+		auto &first = link_change_events[2 * r];
+		first.first = record.time;
+		first.second.type = LINK_CHANGE;
+		first.second.link_change.node = record.first_node;
+		first.second.link_change.neighbor = record.second_node;
+		first.second.link_change.new_cost = record.cost;
+		auto &second = link_change_events[2 * r + 1];
+		second = first;
+		second.second.link_change.node = record.second_node;
+		second.second.link_change.neighbor = record.first_node;
+	}
+
+	munmap(file, file_size);
+}
+
+static void load_topology_events(const std::string &file_name) {
+	// Tell binary files from text files by their magic.
+	char magic[sizeof(TOPOLOGY_MAGIC) - 1] = {0};
+	topology_file.read(magic, sizeof(magic));
+	topology_file.clear();
+	topology_file.seekg(0);
+	if (!memcmp(magic, TOPOLOGY_MAGIC, sizeof(magic))) {
+		load_binary_topology_events(file_name);
+	} else {
+		load_text_topology_events();
+	}
+
+	// Initialize network costs.
+	build_topology();
+	init_routes();
+	init_pending_messages();
+}
+
+static void init_node_states() {
+	for (auto node : nodes) {
+		current_node = node;
+		node_states[current_node] = init_state();
+	}
+}
+
+static void dump_message(std::ostream &dot_file, const event_t &event, bool current) {
+	dot_file << "  node" << event.message.source                                                               //
+	         << " -> node" << event.message.destination                                                        //
+	         << " [ color = \"" << ((!epoch_steps) && current ? COLOR_CURRENT_MESSAGE : COLOR_FUTURE_MESSAGE) //
+	         << "\" style = \"dashed\" ];" << '\n';
+}
+
+static void dump_network_snapshot(std::ostream &dot_file) {
+	const event_t *next_event = peek_event();
+
+	// Graphviz header and timestamp.
+	dot_file << "digraph N {" << '\n'                             //
+	         << "  label = \"t=" << current_time << "\";" << '\n' //
+	         << "  labelloc = \"top\";" << '\n'                   //
+	         << "  labeljust = \"left\";" << '\n';
+
+	// Dump colored nodes. Highlight recipient of next event in bold.
+	for (auto node : nodes) {
+		dot_file << "  node" << node                 //
+		         << " [ label = \"" << node << "\" " //
+		         << "style = \"filled"               //
+		         << (((!epoch_steps) && next_event &&
+		              ((next_event->type == LINK_CHANGE && next_event->link_change.node == node) ||
+		               (next_event->type == MESSAGE && next_event->message.destination == node)))
+		                 ? ",bold"
+		                 : "")
+		         << "\" " //
+		         << "fillcolor = \"" << colors[node] << "\" ];" << '\n';
+	}
+
+	// Bold black lines for undirected topology.
+	// Add dot for interface that is being notified of change.
+	// Each link is listed once, from its lower numbered node.
+	for (node_t first_node = 0; first_node < topology_size; first_node++) {
+		for (size_t l = topology_offsets[first_node]; l < topology_offsets[first_node + 1]; l++) {
+			node_t second_node = topology_links[l].neighbor;
+			cost_t cost = topology_links[l].cost;
+			if (second_node < first_node) {
+				continue;
+			}
+
+			if (cost < COST_INFINITY || (next_event && next_event->type == LINK_CHANGE &&
+			                             ((next_event->link_change.node == first_node && next_event->link_change.neighbor == second_node) ||
+			                              (next_event->link_change.node == second_node && next_event->link_change.neighbor == first_node)))) {
+				dot_file << "  node" << first_node                                                                 //
+				         << " -> node" << second_node                                                              //
+				         << " [ dir = \"both\" "                                                                   //
+				         << "label = \"" << (cost < COST_INFINITY ? std::to_string((int)cost) : "∞") << "\" " //
+				         << "style = \"bold\" "                                                                    //
+				         << "arrowtail = \""
+				         << ((!epoch_steps) && next_event && next_event->type == LINK_CHANGE && next_event->link_change.node == first_node &&
+				                     next_event->link_change.neighbor == second_node
+				                 ? "dot"
+				                 : "none")
+				         << "\" " //
+				         << "arrowhead = \""
+				         << ((!epoch_steps) && next_event && next_event->type == LINK_CHANGE && next_event->link_change.node == second_node &&
+				                     next_event->link_change.neighbor == first_node
+				                 ? "dot"
+				                 : "none")
+				         << "\"];" << '\n';
+			}
+		}
+	}
+
+	// Colored arrows for directed routes.
+	for (auto node : nodes) {
+		if (dirty_route_nodes[node]) {
+			std::ostringstream node_dot;
+			const node_t *next_hops = &route_next_hops[(size_t)node * topology_size];
+			const cost_t *costs = &route_costs[(size_t)node * topology_size];
+			for (node_t destination = 0; destination < topology_size; destination++) {
+				if (costs[destination] < COST_INFINITY && (show_routes_for < 0 || show_routes_for == destination)) {
+					node_dot << "  node" << node                             //
+					         << " -> node" << next_hops[destination]         //
+					         << " [ color = \"" << colors[destination]       //
+					         << "\" fontcolor = \"" << colors[destination]   //
+					         << "\" label = \"" << ((int)costs[destination]) //
+					         << "\" ];" << '\n';
+				}
+			}
+			route_dots[node] = node_dot.str();
+			dirty_route_nodes[node] = false;
+		}
+		dot_file << route_dots[node];
+	}
+
+	// Dashed arrow for messages. Black if being delivered, gray for future
+	// delivery.
+	if (show_messages) {
+		for (size_t e = next_epoch_event; e < epoch_events.size(); e++) {
+			if (epoch_events[e].type == MESSAGE && (show_future_messages || e == next_epoch_event)) {
+				dump_message(dot_file, epoch_events[e], e == next_epoch_event);
+			}
+		}
+		if (show_future_messages) {
+			for (auto &event : next_epoch_messages) {
+				dump_message(dot_file, event, false);
+			}
+		}
+	}
+
+	// Footer.
+	dot_file << "}" << '\n' << '\n';
+}
+
+static void output_writer_main(output_file_t *output) {
+	std::unique_lock<std::mutex> lock(output->mutex);
+	while (true) {
+		output->queue_changed.wait(lock, [output] { return !output->queue.empty() || output->closing; });
+		if (output->queue.empty()) {
+			break;
+		}
+
+		// Write the oldest buffer without holding up the simulation.
+		std::string buffer = std::move(output->queue.front());
+		output->queue.pop_front();
+		output->queue_changed.notify_all();
+		lock.unlock();
+		output->file.write(buffer.data(), buffer.size());
+		lock.lock();
+	}
+	output->file.flush();
+}
+
+static void open_output_file(output_file_t &output, const std::string &file_name) {
+	if (file_name == "/dev/null") {
+		output.enabled = false;
+		return;
+	}
+
+	output.file.open(file_name);
+	if (!output.file.is_open()) {
+		std::cerr << "Error opening output file: " << file_name << std::endl;
+		exit(EXIT_FAILURE);
+	}
+	output.enabled = true;
+	output.closing = false;
+	output.writer = std::thread(output_writer_main, &output);
+}
+
+// Hand the buffer to the writer thread, waiting only if the queue is full.
+static void flush_output_file(output_file_t &output) {
+	std::string buffer = output.buffer.str();
+	output.buffer.str("");
+	if (buffer.empty()) {
+		return;
+	}
+
+	std::unique_lock<std::mutex> lock(output.mutex);
+	output.queue_changed.wait(lock, [&output] { return output.queue.size() < OUTPUT_QUEUE_SIZE; });
+	output.queue.push_back(std::move(buffer));
+	output.queue_changed.notify_all();
+}
+
+static void close_output_file(output_file_t &output) {
+	if (!output.enabled) {
+		return;
+	}
+
+	flush_output_file(output);
+	{
+		std::lock_guard<std::mutex> lock(output.mutex);
+		output.closing = true;
+	}
+	output.queue_changed.notify_all();
+	output.writer.join();
+}
+
+// Handler latency profiling, for --profile-handlers. Latencies are measured in
+// TSC cycles and kept in log-linear histograms, with 2^HISTOGRAM_SUB_BITS
+// buckets per power of two, for each node and handler. Each node's
+// histograms are only touched by the thread running the node.
+#define HISTOGRAM_SUB_BITS 3
+#define HISTOGRAM_BUCKETS (64 << HISTOGRAM_SUB_BITS)
+typedef struct {
+	uint32_t counts[HISTOGRAM_BUCKETS];
+	uint64_t count;
+	uint64_t total;
+	uint64_t max;
+} histogram_t;
+typedef enum { HANDLER_LINK_CHANGE, HANDLER_RECEIVE_MESSAGE, NUM_HANDLERS } handler_t;
+static const char *handler_names[NUM_HANDLERS] = {"notify_link_change", "notify_receive_message"};
+// Number of slowest nodes to report, or -1 when not profiling.
+static int profile_top_nodes = -1;
+static std::vector<histogram_t> node_histograms;
+static uint64_t snapshot_cycles = 0;
+static uint64_t profile_start_cycles;
+static std::chrono::steady_clock::time_point profile_start_time;
+
+static inline uint64_t read_cycles() {
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	return std::chrono::steady_clock::now().time_since_epoch().count();
+#endif
+}
+
+static int histogram_bucket(uint64_t value) {
+	if (value < (1 << HISTOGRAM_SUB_BITS)) {
+		return value;
+	}
+	int exponent = 63 - __builtin_clzll(value);
+	return ((exponent - HISTOGRAM_SUB_BITS + 1) << HISTOGRAM_SUB_BITS) + ((value >> (exponent - HISTOGRAM_SUB_BITS)) & ((1 << HISTOGRAM_SUB_BITS) - 1));
+}
+
+// Middle of the range of values in a bucket.
+static double histogram_value(int bucket) {
+	int group = bucket >> HISTOGRAM_SUB_BITS;
+	if (group == 0) {
+		return bucket;
+	}
+	int shift = group - 1;
+	uint64_t low = (uint64_t)((1 << HISTOGRAM_SUB_BITS) + (bucket & ((1 << HISTOGRAM_SUB_BITS) - 1))) << shift;
+	return low + ((1ull << shift) - 1) / 2.0;
+}
+
+static void add_histogram_value(histogram_t &histogram, uint64_t value) {
+	histogram.counts[histogram_bucket(value)]++;
+	histogram.count++;
+	histogram.total += value;
+	histogram.max = std::max(histogram.max, value);
+}
+
+static void merge_histogram(histogram_t &histogram, const histogram_t &other) {
+	for (int b = 0; b < HISTOGRAM_BUCKETS; b++) {
+		histogram.counts[b] += other.counts[b];
+	}
+	histogram.count += other.count;
+	histogram.total += other.total;
+	histogram.max = std::max(histogram.max, other.max);
+}
+
+static double histogram_percentile(const histogram_t &histogram, double percentile) {
+	uint64_t rank = (uint64_t)(percentile / 100 * histogram.count);
+	uint64_t seen = 0;
+	for (int b = 0; b < HISTOGRAM_BUCKETS; b++) {
+		seen += histogram.counts[b];
+		if (seen > rank) {
+			return std::min(histogram_value(b), (double)histogram.max);
+		}
+	}
+	return histogram.max;
+}
+
+static void start_profile() {
+	if (profile_top_nodes < 0) {
+		return;
+	}
+	node_histograms.assign((size_t)topology_size * NUM_HANDLERS, histogram_t());
+	profile_start_cycles = read_cycles();
+	profile_start_time = std::chrono::steady_clock::now();
+}
+
+static void record_handler_latency(node_t node, handler_t handler, uint64_t start_cycles) {
+	add_histogram_value(node_histograms[(size_t)node * NUM_HANDLERS + handler], read_cycles() - start_cycles);
+}
+
+static void report_profile() {
+	if (profile_top_nodes < 0) {
+		return;
+	}
+
+	// Calibrate cycles against the clock over the whole run.
+	double elapsed_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - profile_start_time).count();
+	double ns_per_cycle = elapsed_ns / std::max<uint64_t>(read_cycles() - profile_start_cycles, 1);
+
+	std::vector<histogram_t> handler_histograms(NUM_HANDLERS, histogram_t());
+	std::vector<std::pair<uint64_t, node_t>> node_totals;
+	for (auto node : nodes) {
+		uint64_t total = 0;
+		for (int h = 0; h < NUM_HANDLERS; h++) {
+			merge_histogram(handler_histograms[h], node_histograms[(size_t)node * NUM_HANDLERS + h]);
+			total += node_histograms[(size_t)node * NUM_HANDLERS + h].total;
+		}
+		node_totals.push_back(std::make_pair(total, node));
+	}
+
+	auto print_histogram = [ns_per_cycle](const histogram_t &histogram) {
+		std::cout << std::setw(10) << histogram.count                                                                //
+		          << std::setw(10) << (histogram.count ? histogram.total * ns_per_cycle / histogram.count : 0)       //
+		          << std::setw(10) << histogram_percentile(histogram, 50) * ns_per_cycle                            //
+		          << std::setw(10) << histogram_percentile(histogram, 90) * ns_per_cycle                            //
+		          << std::setw(10) << histogram_percentile(histogram, 99) * ns_per_cycle                            //
+		          << std::setw(10) << histogram_percentile(histogram, 99.9) * ns_per_cycle                          //
+		          << std::setw(10) << histogram.max * ns_per_cycle << std::endl;
+	};
+
+	std::cout << std::fixed << std::setprecision(0) << "Handler latency (ns):" << std::setw(25) << "count" << std::setw(10) << "mean" << std::setw(10) << "p50"
+	          << std::setw(10) << "p90" << std::setw(10) << "p99" << std::setw(10) << "p99.9" << std::setw(10) << "max" << std::endl;
+	uint64_t handler_cycles = 0;
+	for (int h = 0; h < NUM_HANDLERS; h++) {
+		std::cout << "  " << std::left << std::setw(34) << handler_names[h] << std::right;
+		print_histogram(handler_histograms[h]);
+		handler_cycles += handler_histograms[h].total;
+	}
+
+	std::cout << std::setprecision(3) << "Time in handlers: " << handler_cycles * ns_per_cycle / 1e9 << " s, snapshots: " << snapshot_cycles * ns_per_cycle / 1e9
+	          << " s, run: " << elapsed_ns / 1e9 << " s." << std::endl;
+
+	// Slowest nodes, by total time in handlers.
+	std::sort(node_totals.begin(), node_totals.end(), [](const std::pair<uint64_t, node_t> &a, const std::pair<uint64_t, node_t> &b) { return a.first > b.first; });
+	if (node_totals.size() > (size_t)profile_top_nodes) {
+		node_totals.resize(profile_top_nodes);
+	}
+	std::cout << std::setprecision(0) << "Slowest nodes (ns):" << std::setw(27) << "count" << std::setw(10) << "mean" << std::setw(10) << "p50" << std::setw(10)
+	          << "p90" << std::setw(10) << "p99" << std::setw(10) << "p99.9" << std::setw(10) << "max" << std::endl;
+	for (auto &node_total : node_totals) {
+		histogram_t histogram = histogram_t();
+		for (int h = 0; h < NUM_HANDLERS; h++) {
+			merge_histogram(histogram, node_histograms[(size_t)node_total.second * NUM_HANDLERS + h]);
+		}
+		std::cout << "  node " << std::left << std::setw(29) << node_total.second << std::right;
+		print_histogram(histogram);
+	}
+}
+
+static void take_snapshot(output_file_t &output) {
+	if (!output.enabled) {
+		return;
+	}
+
+	uint64_t start_cycles = profile_top_nodes >= 0 ? read_cycles() : 0;
+	dump_network_snapshot(output.buffer);
+	if (output.buffer.tellp() >= OUTPUT_BUFFER_SIZE) {
+		flush_output_file(output);
+	}
+	if (profile_top_nodes >= 0) {
+		snapshot_cycles += read_cycles() - start_cycles;
+	}
+}
+
+static void write_trace_records(const trace_record_t *records, size_t count) {
+	trace_output.buffer.write((const char *)records, sizeof(trace_record_t) * count);
+	if (trace_output.buffer.tellp() >= OUTPUT_BUFFER_SIZE) {
+		flush_output_file(trace_output);
+	}
+}
+
+// Write the nodes, their colors and the links, which the records refer to.
+static void write_trace_header() {
+	if (!trace_output.enabled) {
+		return;
+	}
+
+	trace_header_t header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+	header.node_count = nodes.size();
+	header.link_count = topology_links.size() / 2;
+	trace_output.buffer.write((const char *)&header, sizeof(header));
+
+	for (auto node : nodes) {
+		trace_node_t trace_node;
+		memset(&trace_node, 0, sizeof(trace_node));
+		trace_node.node = node;
+		strncpy(trace_node.color, colors[node].c_str(), sizeof(trace_node.color) - 1);
+		trace_output.buffer.write((const char *)&trace_node, sizeof(trace_node));
+	}
+
+	for (node_t first_node = 0; first_node < topology_size; first_node++) {
+		for (size_t l = topology_offsets[first_node]; l < topology_offsets[first_node + 1]; l++) {
+			if (topology_links[l].neighbor > first_node) {
+				trace_link_t trace_link;
+				trace_link.first_node = first_node;
+				trace_link.second_node = topology_links[l].neighbor;
+				trace_output.buffer.write((const char *)&trace_link, sizeof(trace_link));
+			}
+		}
+	}
+}
+
+static void add_trace_record(trace_record_type_t type, cost_t cost, node_t node, node_t other, int32_t value) {
+	if (!trace_output.enabled) {
+		return;
+	}
+
+	trace_record_t record;
+	memset(&record, 0, sizeof(record));
+	record.type = type;
+	record.cost = cost;
+	record.node = node;
+	record.other = other;
+	record.value = value;
+	if (trace_slot) {
+		trace_slot->push_back(record);
+	} else {
+		write_trace_records(&record, 1);
+	}
+}
+
+// Queue a message for the next epoch. With coalesce_messages, a message on a
+// link that already has one pending takes its place, and the older one is
+// dropped undelivered.
+static void add_next_epoch_message(const event_t &event) {
+	if (coalesce_messages) {
+		link_t *link = find_topology_link(event.message.source, event.message.destination);
+		auto &pending = pending_link_messages[link - topology_links.data()];
+		if (pending.first == epoch_time) {
+			event_t &pending_event = next_epoch_messages[pending.second];
+			message_t message;
+			message.data = pending_event.message.content;
+			message.size = pending_event.message.size;
+			release_message(message);
+			pending_event.message.content = event.message.content;
+			pending_event.message.size = event.message.size;
+			++num_coalesced_messages;
+			return;
+		}
+		pending = std::make_pair(epoch_time, next_epoch_messages.size());
+	}
+
+	next_epoch_messages.push_back(event);
+	add_trace_record(TRACE_SEND, 0, event.message.source, event.message.destination, 0);
+}
+
+// Deliver message to node and drop the event's reference to the message buffer.
+static void deliver_message(const event_t &event) {
+	current_node = event.message.destination;
+	add_trace_record(TRACE_DELIVER, 0, event.message.source, event.message.destination, 0);
+	message_t message;
+	message.data = event.message.content;
+	message.size = event.message.size;
+	uint64_t start_cycles = profile_top_nodes >= 0 ? read_cycles() : 0;
+	notify_receive_message(event.message.source, message);
+	if (profile_top_nodes >= 0) {
+		record_handler_latency(current_node, HANDLER_RECEIVE_MESSAGE, start_cycles);
+	}
+	release_message(message);
+}
+
+static void process_event(event_t event) {
+	switch (event.type) {
+	case LINK_CHANGE: { // Update topology and notify node.
+		set_topology_cost(event.link_change.node, event.link_change.neighbor, event.link_change.new_cost);
+		changed = true;
+		add_trace_record(TRACE_LINK_CHANGE, event.link_change.new_cost, event.link_change.node, event.link_change.neighbor, 0);
+
+		current_node = event.link_change.node;
+		uint64_t start_cycles = profile_top_nodes >= 0 ? read_cycles() : 0;
+		notify_link_change(event.link_change.neighbor, event.link_change.new_cost);
+		if (profile_top_nodes >= 0) {
+			record_handler_latency(current_node, HANDLER_LINK_CHANGE, start_cycles);
+		}
+		++num_link_changes;
+	} break;
+
+	case MESSAGE: {
+		deliver_message(event);
+		++num_messages;
+		num_message_bytes += event.message.size;
+	} break;
+
+	default: {
+		assert(false && "Unknown event type.");
+	}
+	}
+}
+
+// Deliver the messages in the current epoch's mailboxes, one node at a time.
+static void run_mailboxes() {
+	for (size_t m = next_mailbox++; m < mailbox_nodes.size(); m = next_mailbox++) {
+		for (auto e : mailboxes[mailbox_nodes[m]]) {
+			outbox = &event_outboxes[e];
+			trace_slot = &event_traces[e];
+			deliver_message(epoch_events[e]);
+		}
+	}
+	outbox = NULL;
+	trace_slot = NULL;
+
+	if (changed) {
+		workers_changed = true;
+		changed = false;
+	}
+}
+
+static void worker_main() {
+	long generation = 0;
+	std::unique_lock<std::mutex> lock(workers_mutex);
+	while (true) {
+		workers_start.wait(lock, [&] { return workers_exit || workers_generation != generation; });
+		if (workers_exit) {
+			return;
+		}
+		generation = workers_generation;
+
+		lock.unlock();
+		run_mailboxes();
+		lock.lock();
+
+		if (--workers_running == 0) {
+			workers_done.notify_one();
+		}
+	}
+}
+
+static void start_workers() {
+	mailboxes.resize(topology_size);
+	for (int t = 1; t < num_threads; t++) {
+		workers.emplace_back(worker_main);
+	}
+}
+
+static void stop_workers() {
+	{
+		std::lock_guard<std::mutex> lock(workers_mutex);
+		workers_exit = true;
+	}
+	workers_start.notify_all();
+	for (auto &worker : workers) {
+		worker.join();
+	}
+	workers.clear();
+}
+
+// Deliver the rest of the current epoch's messages in parallel.
+// Messages of an epoch come after its link changes, so once the first one is
+// reached, everything left in the bucket is a message.
+static void process_epoch_messages() {
+	size_t end = epoch_events.size();
+	if (max_events >= 0 && (long)(end - next_epoch_event) > max_events - num_events) {
+		end = next_epoch_event + (max_events - num_events);
+	}
+
+	// Sort messages into per-node mailboxes.
+	for (size_t e = next_epoch_event; e < end; e++) {
+		assert(epoch_events[e].type == MESSAGE && "Link change after messages in epoch.");
+		node_t node = epoch_events[e].message.destination;
+		if (mailboxes[node].empty()) {
+			mailbox_nodes.push_back(node);
+		}
+		mailboxes[node].push_back(e);
+		num_message_bytes += epoch_events[e].message.size;
+	}
+	if (event_outboxes.size() < end) {
+		event_outboxes.resize(end);
+		event_traces.resize(end);
+	}
+
+	// Run the mailboxes on the workers and this thread, and wait for all of them.
+	next_mailbox = 0;
+	{
+		std::lock_guard<std::mutex> lock(workers_mutex);
+		workers_running = workers.size();
+		++workers_generation;
+	}
+	workers_start.notify_all();
+	run_mailboxes();
+	{
+		std::unique_lock<std::mutex> lock(workers_mutex);
+		workers_done.wait(lock, [] { return workers_running == 0; });
+	}
+
+	// Merge trace records and outgoing messages in event order.
+	for (size_t e = next_epoch_event; e < end; e++) {
+		write_trace_records(event_traces[e].data(), event_traces[e].size());
+		event_traces[e].clear();
+		for (auto &event : event_outboxes[e]) {
+			add_next_epoch_message(event);
+		}
+		event_outboxes[e].clear();
+	}
+	for (auto node : mailbox_nodes) {
+		mailboxes[node].clear();
+	}
+	mailbox_nodes.clear();
+
+	num_events += end - next_epoch_event;
+	num_messages += end - next_epoch_event;
+	next_epoch_event = end;
+	if (workers_changed.exchange(false)) {
+		changed = true;
+	}
+}
+
+// Checkpoints hold the whole simulation state between two events, in native
+// byte order. Message data and node states are saved as opaque bytes.
+#define CHECKPOINT_MAGIC "RSIMCKP2"
+
+template <typename T> static void write_value(std::ostream &file, const T &value) { file.write((const char *)&value, sizeof(T)); }
+
+template <typename T> static void write_vector(std::ostream &file, const T *values, size_t count) {
+	write_value(file, count);
+	file.write((const char *)values, sizeof(T) * count);
+}
+
+static void read_error() {
+	std::cerr << "Error reading checkpoint file." << std::endl;
+	exit(EXIT_FAILURE);
+}
+
+template <typename T> static void read_value(std::istream &file, T &value) {
+	if (!file.read((char *)&value, sizeof(T))) {
+		read_error();
+	}
+}
+
+template <typename T> static void read_vector(std::istream &file, std::vector<T> &values) {
+	size_t count;
+	read_value(file, count);
+	values.resize(count);
+	if (!file.read((char *)values.data(), sizeof(T) * count)) {
+		read_error();
+	}
+}
+
+// Save events, with the data of the messages they carry.
+static void write_events(std::ostream &file, const event_t *events, size_t count) {
+	write_value(file, count);
+	for (size_t e = 0; e < count; e++) {
+		write_value(file, events[e]);
+		if (events[e].type == MESSAGE) {
+			file.write((const char *)events[e].message.content, events[e].message.size);
+		}
+	}
+}
+
+// Load events, each message into a buffer of its own.
+static void read_events(std::istream &file, std::vector<event_t> &events) {
+	size_t count;
+	read_value(file, count);
+	events.resize(count);
+	for (auto &event : events) {
+		read_value(file, event);
+		if (event.type == MESSAGE) {
+			message_t message = create_heap_message(event.message.size);
+			if (!file.read((char *)message.data, message.size)) {
+				read_error();
+			}
+			event.message.content = message.data;
+		}
+	}
+}
+
+static void save_checkpoint(const std::string &file_name) {
+	std::ofstream file(file_name, std::ios::binary);
+	if (!file.is_open()) {
+		std::cerr << "Error opening output file: " << file_name << std::endl;
+		exit(EXIT_FAILURE);
+	}
+
+	file.write(CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC) - 1);
+	write_vector(file, simulator_name.data(), simulator_name.size());
+
+	// Time and stats.
+	write_value(file, current_time);
+	write_value(file, epoch_time);
+	write_value(file, changed);
+	write_value(file, num_events);
+	write_value(file, num_link_changes);
+	write_value(file, num_messages);
+	write_value(file, num_message_bytes);
+	write_value(file, num_route_changes.load(std::memory_order_relaxed));
+	write_value(file, num_coalesced_messages);
+	std::map<std::string, long> counter_sums = sum_router_counters();
+	write_value(file, counter_sums.size());
+	for (auto &counter : counter_sums) {
+		write_vector(file, counter.first.data(), counter.first.size());
+		write_value(file, counter.second);
+	}
+
+	// Nodes and their colors.
+	for (auto node : nodes) {
+		write_value(file, node);
+		write_vector(file, colors[node].data(), colors[node].size());
+	}
+	write_value(file, (node_t)-1);
+
+	// Topology, with its current costs.
+	write_value(file, topology_size);
+	write_vector(file, topology_offsets.data(), topology_offsets.size());
+	write_vector(file, topology_links.data(), topology_links.size());
+
+	// Events left to process.
+	write_vector(file, link_change_events.data() + next_link_change, link_change_events.size() - next_link_change);
+	write_events(file, epoch_events.data() + next_epoch_event, epoch_events.size() - next_epoch_event);
+	write_events(file, next_epoch_messages.data(), next_epoch_messages.size());
+
+	// Routes and node states.
+	for (auto node : nodes) {
+		const node_t *next_hops = &route_next_hops[(size_t)node * topology_size];
+		const cost_t *costs = &route_costs[(size_t)node * topology_size];
+		size_t num_routes = 0;
+		for (node_t destination = 0; destination < topology_size; destination++) {
+			num_routes += costs[destination] < COST_INFINITY;
+		}
+		write_value(file, num_routes);
+		for (node_t destination = 0; destination < topology_size; destination++) {
+			if (costs[destination] < COST_INFINITY) {
+				write_value(file, destination);
+				write_value(file, next_hops[destination]);
+				write_value(file, costs[destination]);
+			}
+		}
+
+		current_node = node;
+		std::vector<char> state(state_size());
+		serialize_state(state.data());
+		write_vector(file, state.data(), state.size());
+	}
+
+	if (!file) {
+		std::cerr << "Error writing checkpoint file: " << file_name << std::endl;
+		exit(EXIT_FAILURE);
+	}
+}
+
+// Restore a checkpoint, in place of loading the topology and initializing nodes.
+static void load_checkpoint(const std::string &file_name) {
+	std::ifstream file(file_name, std::ios::binary);
+	if (!file.is_open()) {
+		std::cerr << "Error opening checkpoint file: " << file_name << std::endl;
+		exit(EXIT_FAILURE);
+	}
+
+	char magic[sizeof(CHECKPOINT_MAGIC) - 1];
+	std::vector<char> name;
+	if (!file.read(magic, sizeof(magic)) || memcmp(magic, CHECKPOINT_MAGIC, sizeof(magic))) {
+		read_error();
+	}
+	read_vector(file, name);
+	if (std::string(name.begin(), name.end()) != simulator_name) {
+		std::cerr << "Checkpoint was saved by " << std::string(name.begin(), name.end()) << "." << std::endl;
+		exit(EXIT_FAILURE);
+	}
+
+	// Time and stats.
+	read_value(file, current_time);
+	read_value(file, epoch_time);
+	read_value(file, changed);
+	read_value(file, num_events);
+	read_value(file, num_link_changes);
+	read_value(file, num_messages);
+	read_value(file, num_message_bytes);
+	long route_changes;
+	read_value(file, route_changes);
+	num_route_changes.store(route_changes, std::memory_order_relaxed);
+	read_value(file, num_coalesced_messages);
+	size_t num_counters;
+	read_value(file, num_counters);
+	for (size_t c = 0; c < num_counters; c++) {
+		std::vector<char> name;
+		long value;
+		read_vector(file, name);
+		read_value(file, value);
+		add_counter(get_counter(std::string(name.begin(), name.end()).c_str()), value);
+	}
+
+	// Nodes and their colors.
+	while (true) {
+		node_t node;
+		std::vector<char> color;
+		read_value(file, node);
+		if (node < 0) {
+			break;
+		}
+		read_vector(file, color);
+		nodes.insert(node);
+		colors[node] = std::string(color.begin(), color.end());
+	}
+
+	// Topology, with its current costs.
+	read_value(file, topology_size);
+	read_vector(file, topology_offsets);
+	read_vector(file, topology_links);
+	if (topology_size < 0 || (!nodes.empty() && *nodes.rbegin() >= topology_size) || topology_offsets.size() != (size_t)topology_size + 1 ||
+	    topology_offsets[0] != 0 || topology_offsets[topology_size] != topology_links.size()) {
+		read_error();
+	}
+	for (node_t node = 0; node < topology_size; node++) {
+		if (topology_offsets[node] > topology_offsets[node + 1]) {
+			read_error();
+		}
+	}
+	for (auto &link : topology_links) {
+		if (!nodes.count(link.neighbor)) {
+			read_error();
+		}
+	}
+	if (topology_size <= DENSE_TOPOLOGY_NODES) {
+		topology_matrix.assign((size_t)topology_size * topology_size, COST_INFINITY);
+		for (node_t node = 0; node < topology_size; node++) {
+			for (size_t l = topology_offsets[node]; l < topology_offsets[node + 1]; l++) {
+				topology_matrix[(size_t)node * topology_size + topology_links[l].neighbor] = topology_links[l].cost;
+			}
+		}
+	}
+
+	// Events left to process.
+	read_vector(file, link_change_events);
+	read_events(file, epoch_events);
+	read_events(file, next_epoch_messages);
+	init_pending_messages();
+
+	// Routes and node states.
+	init_routes();
+	for (auto node : nodes) {
+		size_t num_routes;
+		read_value(file, num_routes);
+		for (size_t r = 0; r < num_routes; r++) {
+			node_t destination;
+			node_t next_hop;
+			cost_t cost;
+			read_value(file, destination);
+			read_value(file, next_hop);
+			read_value(file, cost);
+			if (node >= topology_size || destination < 0 || destination >= topology_size) {
+				read_error();
+			}
+			route_next_hops[(size_t)node * topology_size + destination] = next_hop;
+			route_costs[(size_t)node * topology_size + destination] = cost;
+		}
+
+		std::vector<char> state;
+		read_vector(file, state);
+		current_node = node;
+		node_states[node] = deserialize_state(state.data(), state.size());
+	}
+}
+
+static stats_totals_t get_stats_totals() {
+	stats_totals_t totals;
+	totals.events = num_events;
+	totals.link_changes = num_link_changes;
+	totals.messages = num_messages;
+	totals.message_bytes = num_message_bytes;
+	totals.route_changes = num_route_changes.load(std::memory_order_relaxed);
+	totals.time = std::chrono::steady_clock::now();
+	return totals;
+}
+
+// Resident set size in KiB, or 0 if unknown.
+static long get_rss_kb() {
+	int fd = open("/proc/self/statm", O_RDONLY);
+	if (fd < 0) {
+		return 0;
+	}
+	char buffer[128];
+	ssize_t length = read(fd, buffer, sizeof(buffer) - 1);
+	close(fd);
+	if (length <= 0) {
+		return 0;
+	}
+	buffer[length] = '\0';
+
+	long pages = 0;
+	sscanf(buffer, "%*s %ld", &pages);
+	return pages * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+// Peak resident set size in KiB so far, including spikes within epochs.
+static long get_peak_rss_kb() {
+	struct rusage usage;
+	return getrusage(RUSAGE_SELF, &usage) == 0 ? usage.ru_maxrss : 0;
+}
+
+static bool stats_enabled() { return stats_csv_output.enabled || stats_json_output.enabled || progress_interval > 0; }
+
+static void show_progress(const stats_totals_t &totals) {
+	double elapsed = std::chrono::duration<double>(totals.time - start_time).count();
+	std::cerr << "Progress: epoch " << current_time << ", " << totals.events << " events, " << totals.messages << " messages, "
+	          << epoch_events.size() - next_epoch_event + next_epoch_messages.size() << " queued, " << get_rss_kb() / 1024 << " MiB, " << elapsed << " s." << std::endl;
+	next_progress_time = totals.time + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(progress_interval));
+}
+
+// Check whether a progress line is due, in the middle of long epochs.
+static void check_progress() {
+	if (progress_interval > 0 && std::chrono::steady_clock::now() >= next_progress_time) {
+		show_progress(get_stats_totals());
+	}
+}
+
+static void start_stats() {
+	if (stats_csv_output.enabled) {
+		stats_csv_output.buffer << "epoch,events,link_changes,messages,message_bytes,route_changes,queue_depth,duration,elapsed,rss_kb,peak_rss_kb\n";
+	}
+
+	epoch_start_totals = get_stats_totals();
+	start_time = epoch_start_totals.time;
+	next_rss_sample_time = start_time;
+	next_progress_time = start_time + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(progress_interval));
+}
+
+// Write the stats of the epoch that just ended, the last one if last_epoch, and
+// start counting the next one.
+static void end_epoch_stats(bool last_epoch) {
+	if (!stats_enabled()) {
+		return;
+	}
+
+	// Routes set up by init_state don't belong to any epoch.
+	stats_totals_t totals = get_stats_totals();
+	if (current_time < 0) {
+		epoch_start_totals = totals;
+		return;
+	}
+
+	long events = totals.events - epoch_start_totals.events;
+	long link_changes = totals.link_changes - epoch_start_totals.link_changes;
+	long messages = totals.messages - epoch_start_totals.messages;
+	long message_bytes = totals.message_bytes - epoch_start_totals.message_bytes;
+	long route_changes = totals.route_changes - epoch_start_totals.route_changes;
+	// Events left in the queue, including the next epoch's bucket if already filled.
+	size_t queue_depth = epoch_events.size() - next_epoch_event + next_epoch_messages.size();
+	double duration = std::chrono::duration<double>(totals.time - epoch_start_totals.time).count();
+	double elapsed = std::chrono::duration<double>(totals.time - start_time).count();
+	if ((stats_csv_output.enabled || stats_json_output.enabled) && (totals.time >= next_rss_sample_time || last_epoch)) {
+		rss_kb_sample = get_rss_kb();
+		peak_rss_kb_sample = get_peak_rss_kb();
+		next_rss_sample_time = totals.time + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(RSS_SAMPLE_INTERVAL));
+	}
+	long rss_kb = rss_kb_sample;
+	long peak_rss_kb = peak_rss_kb_sample;
+
+	if (stats_csv_output.enabled) {
+		stats_csv_output.buffer << current_time << ',' << events << ',' << link_changes << ',' << messages << ',' << message_bytes << ','
+		                        << route_changes << ',' << queue_depth << ',' << duration << ',' << elapsed << ',' << rss_kb << ',' << peak_rss_kb << '\n';
+		if (stats_csv_output.buffer.tellp() >= OUTPUT_BUFFER_SIZE) {
+			flush_output_file(stats_csv_output);
+		}
+	}
+	if (stats_json_output.enabled) {
+		stats_json_output.buffer << "{\"epoch\": " << current_time << ", \"events\": " << events << ", \"link_changes\": " << link_changes
+		                         << ", \"messages\": " << messages << ", \"message_bytes\": " << message_bytes << ", \"route_changes\": " << route_changes
+		                         << ", \"queue_depth\": " << queue_depth << ", \"duration\": " << duration << ", \"elapsed\": " << elapsed
+		                         << ", \"rss_kb\": " << rss_kb << ", \"peak_rss_kb\": " << peak_rss_kb << "}\n";
+		if (stats_json_output.buffer.tellp() >= OUTPUT_BUFFER_SIZE) {
+			flush_output_file(stats_json_output);
+		}
+	}
+	if (progress_interval > 0 && totals.time >= next_progress_time) {
+		show_progress(totals);
+	}
+
+	epoch_start_totals = totals;
+}
+
+static void process_events() {
+	// Continue until no more events.
+	while (fill_epoch_events() && (max_events < 0 || num_events < max_events)) {
+		if (current_time != epoch_time) {
+			end_epoch_stats(false);
+			current_time = epoch_time;
+			add_trace_record(TRACE_EPOCH, 0, -1, -1, current_time);
+		}
+
+		if (!checkpoint_file_name.empty() && current_time >= checkpoint_epoch) {
+			save_checkpoint(checkpoint_file_name);
+			checkpoint_file_name.clear();
+		}
+
+		static event_time_t last_snapshot_epoch = -1;
+		if (steps_dot_output.enabled && (!epoch_steps || current_time > last_snapshot_epoch)) {
+			last_snapshot_epoch = current_time;
+
+			if (!epoch_steps || changed) {
+				take_snapshot(steps_dot_output);
+				changed = false;
+			}
+		}
+
+		if (num_threads > 1 && epoch_events[next_epoch_event].type == MESSAGE) {
+			process_epoch_messages();
+			continue;
+		}
+
+		// Remove event from queue and process it.
+		event_t event = epoch_events[next_epoch_event++];
 
-// Simulation stats
-static long num_events = 0;
-static long num_link_changes = 0;
-static long num_messages = 0;
+		process_event(event);
+		++num_events;
+		if ((num_events & 0xffff) == 0) {
+			check_progress();
+		}
+	}
+	end_epoch_stats(true);
+	if (!epoch_steps || changed) {
+		take_snapshot(steps_dot_output);
+	}
+	take_snapshot(final_dot_output);
 
-static cost_t get_topology_cost(node_t first_node, node_t second_node) {
-	// Avoid data duplication in undirected network graph.
-	if (first_node > second_node) {
-		std::swap(first_node, second_node);
+	// The run ended before the checkpoint's epoch, save where it stopped.
+	if (!checkpoint_file_name.empty()) {
+		save_checkpoint(checkpoint_file_name);
 	}
 
-	if (first_node == second_node) {
-		return 0;
-	} else if (topology.count(std::make_pair(first_node, second_node))) {
-		return topology[std::make_pair(first_node, second_node)];
-	} else {
-		return COST_INFINITY;
+	// Record the event the run stopped at, if any.
+	if (trace_output.enabled) {
+		const event_t *next_event = peek_event();
+		if (!next_event) {
+			add_trace_record(TRACE_END, 0, -1, -1, 0);
+		} else if (next_event->type == LINK_CHANGE) {
+			add_trace_record(TRACE_END, TRACE_LINK_CHANGE, next_event->link_change.node, next_event->link_change.neighbor, epoch_time);
+		} else {
+			add_trace_record(TRACE_END, TRACE_DELIVER, next_event->message.source, next_event->message.destination, epoch_time);
+		}
 	}
 }
 
-static void set_topology_cost(node_t first_node, node_t second_node, cost_t cost) {
-	assert(first_node != second_node && "Setting cost of self-edge.");
-	// Avoid data duplication in undirected network graph.
-	if (first_node > second_node) {
-		std::swap(first_node, second_node);
-	}
+/******************************************************************************\
+* Scenario sweeps.                                                             *
+\******************************************************************************/
 
-	topology[std::make_pair(first_node, second_node)] = cost;
-}
+// Number of scenarios to run at once.
+static int sweep_jobs = std::max(1u, std::thread::hardware_concurrency());
 
-static void make_color(node_t node) {
-	if (!colors.count(node)) { // Generate new color if not already defined.
-		// Random hue, full saturation and value.
-		colors[node] = std::to_string((float)rand() / RAND_MAX) + " 1.0 1.0";
+// Merge a scenario's link changes into the base topology's, after the base
+// topology's own changes within an epoch. Scenarios can only change links
+// that are in the base topology, which is built once before the sweep.
+static bool load_scenario_events(const std::string &file_name) {
+	std::ifstream file(file_name);
+	if (!file.is_open()) {
+		std::cerr << "Error opening scenario file: " << file_name << std::endl;
+		return false;
 	}
-}
 
-static void load_topology_events() {
+	size_t base_size = link_change_events.size();
 	std::string line;
-	// Iterate file lines.
-	while (std::getline(topology_file, line)) {
+	while (std::getline(file, line)) {
 		std::istringstream iss(line);
 		event_time_t time;
 		node_t first_node, second_node;
 		unsigned cost_int; // Used to read cost as a number and not a char.
-		// Parse line.
-		if (!(iss >> time >> first_node >> second_node >> cost_int)) {
-			std::cerr << "Syntax error in topology file." << std::endl;
-			exit(EXIT_FAILURE);
+		if (!(iss >> time >> first_node >> second_node >> cost_int) || first_node == second_node || !find_topology_link(first_node, second_node)) {
+			std::cerr << "Syntax error in scenario file, or link not in topology: " << file_name << std::endl;
+			return false;
 		}
-		cost_t cost = cost_int > COST_INFINITY ? COST_INFINITY : cost_int;
 
-		// Insert two link change events, one for each side of the link.
 		event_t event;
 		event.type = LINK_CHANGE;
 		event.link_change.node = first_node;
 		event.link_change.neighbor = second_node;
-		event.link_change.new_cost = cost;
-		events.insert(std::make_pair(time, event));
+		event.link_change.new_cost = cost_int > COST_INFINITY ? COST_INFINITY : cost_int;
+		link_change_events.push_back(std::make_pair(time, event));
 		event.link_change.node = second_node;
 		event.link_change.neighbor = first_node;
-		events.insert(std::make_pair(time, event));
-
-		// Keep track of known nodes.
-		nodes.insert(first_node);
-		nodes.insert(second_node);
-
-		// Generate colors for the nodes, as needed.
-		make_color(first_node);
-		make_color(second_node);
+		link_change_events.push_back(std::make_pair(time, event));
 	}
 
-	// Initialize network costs.
-	for (auto first_node : nodes) {
-		for (auto second_node : nodes) {
-			if (first_node < second_node) {
-				set_topology_cost(first_node, second_node, COST_INFINITY);
-			}
-		}
-	}
+	auto by_time = [](const std::pair<event_time_t, event_t> &a, const std::pair<event_time_t, event_t> &b) { return a.first < b.first; };
+	std::stable_sort(link_change_events.begin() + base_size, link_change_events.end(), by_time);
+	std::inplace_merge(link_change_events.begin(), link_change_events.begin() + base_size, link_change_events.end(), by_time);
+	return true;
 }
 
-static void init_node_states() {
-	for (auto node : nodes) {
-		current_node = node;
-		node_states[current_node] = init_state();
+// Run one scenario in a child process, with its own copy of the simulation
+// state, and write its results row to fd.
+static void run_scenario(const std::string &file_name, int fd) {
+	auto scenario_start_time = std::chrono::steady_clock::now();
+	if (!load_scenario_events(file_name)) {
+		_exit(EXIT_FAILURE);
 	}
-}
-
-static void dump_network_snapshot(std::ostream &dot_file) {
-	// Graphviz header and timestamp.
-	dot_file << "digraph N {" << std::endl                             //
-	         << "  label = \"t=" << current_time << "\";" << std::endl //
-	         << "  labelloc = \"top\";" << std::endl                   //
-	         << "  labeljust = \"left\";" << std::endl;
-
-	// Dump colored nodes. Highlight recipient of next event in bold.
-	for (auto node : nodes) {
-		dot_file << "  node" << node                 //
-		         << " [ label = \"" << node << "\" " //
-		         << "style = \"filled"               //
-		         << (((!epoch_steps) && (!events.empty()) &&
-		              ((events.begin()->second.type == LINK_CHANGE && events.begin()->second.link_change.node == node) ||
-		               (events.begin()->second.type == MESSAGE && events.begin()->second.message.destination == node)))
-		                 ? ",bold"
-		                 : "")
-		         << "\" " //
-		         << "fillcolor = \"" << colors[node] << "\" ];" << std::endl;
+	init_node_states();
+	if (num_threads > 1) {
+		start_workers();
 	}
+	start_stats();
+	process_events();
+	stop_workers();
+	double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - scenario_start_time).count();
 
-	// Bold black lines for undirected topology.
-	// Add dot for interface that is being notified of change.
-	for (auto edge : topology) {
-		if (edge.second < COST_INFINITY || ((!events.empty()) && events.begin()->second.type == LINK_CHANGE &&
-		                                    ((events.begin()->second.link_change.node == edge.first.first && events.begin()->second.link_change.neighbor == edge.first.second) ||
-		                                     (events.begin()->second.link_change.node == edge.first.second && events.begin()->second.link_change.neighbor == edge.first.first)))) {
-			dot_file << "  node" << edge.first.first                                                                    //
-			         << " -> node" << edge.first.second                                                                 //
-			         << " [ dir = \"both\" "                                                                            //
-			         << "label = \"" << (edge.second < COST_INFINITY ? std::to_string((int)edge.second) : "∞") << "\" " //
-			         << "style = \"bold\" "                                                                             //
-			         << "arrowtail = \""
-			         << ((!epoch_steps) && (!events.empty()) && events.begin()->second.type == LINK_CHANGE && events.begin()->second.link_change.node == edge.first.first &&
-			                     events.begin()->second.link_change.neighbor == edge.first.second
-			                 ? "dot"
-			                 : "none")
-			         << "\" " //
-			         << "arrowhead = \""
-			         << ((!epoch_steps) && (!events.empty()) && events.begin()->second.type == LINK_CHANGE && events.begin()->second.link_change.node == edge.first.second &&
-			                     events.begin()->second.link_change.neighbor == edge.first.first
-			                 ? "dot"
-			                 : "none")
-			         << "\"];" << std::endl;
-		}
+	std::ostringstream row;
+	row << file_name << ",ok," << num_events << ',' << num_link_changes << ',' << num_messages << ',' << num_message_bytes << ',' << current_time << ','
+	    << wall;
+	std::string text = row.str();
+	if (write(fd, text.data(), text.size()) != (ssize_t)text.size()) {
+		_exit(EXIT_FAILURE);
 	}
+	_exit(EXIT_SUCCESS);
+}
 
-	// Colored arrows for directed routes.
-	for (auto node : routes) {
-		for (auto destination : node.second) {
-			if ((show_routes_for < 0 || show_routes_for == destination.first)) {
-				dot_file << "  node" << node.first                              //
-				         << " -> node" << destination.second.first              //
-				         << " [ color = \"" << colors[destination.first]        //
-				         << "\" fontcolor = \"" << colors[destination.first]    //
-				         << "\" label = \"" << ((int)destination.second.second) //
-				         << "\" ];" << std::endl;
-			}
-		}
+// Run every scenario listed in list_file_name on top of the loaded topology,
+// sweep_jobs at a time, and write one CSV row per scenario, in list order.
+// Each scenario is run in a forked process: the engine's state is global, and
+// forking after loading shares the topology between scenarios, copy-on-write.
+static void run_sweep(const std::string &list_file_name, const std::string &results_file_name) {
+	std::ifstream list_file(list_file_name);
+	if (!list_file.is_open()) {
+		std::cerr << "Error opening scenario list: " << list_file_name << std::endl;
+		exit(EXIT_FAILURE);
 	}
-
-	// Dashed arrow for messages. Black if being delivered, gray for future
-	// delivery.
-	if (show_messages) {
-		for (auto event = events.begin(); event != events.end(); event++) {
-			if (event->second.type == MESSAGE) {
-				if (show_future_messages || event == events.begin()) {
-					dot_file << "  node" << event->second.message.source                                                                      //
-					         << " -> node" << event->second.message.destination                                                               //
-					         << " [ color = \"" << ((!epoch_steps) && event == events.begin() ? COLOR_CURRENT_MESSAGE : COLOR_FUTURE_MESSAGE) //
-					         << "\" style = \"dashed\" ];" << std::endl;
-				}
-			}
+	std::vector<std::string> scenarios;
+	std::string line;
+	while (std::getline(list_file, line)) {
+		if (!line.empty()) {
+			scenarios.push_back(line);
 		}
 	}
 
-	// Footer.
-	dot_file << "}" << std::endl << std::endl;
-}
-
-static void process_event(event_t event) {
-	switch (event.type) {
-	case LINK_CHANGE: { // Update topology and notify node.
-		set_topology_cost(event.link_change.node, event.link_change.neighbor, event.link_change.new_cost);
-		changed = true;
-
-		current_node = event.link_change.node;
-		notify_link_change(event.link_change.neighbor, event.link_change.new_cost);
-		++num_link_changes;
-	} break;
-
-	case MESSAGE: { // Deliver message to node and free the message buffer.
-		current_node = event.message.destination;
-		message_t message;
-		message.data = event.message.content;
-		message.size = event.message.size;
-		notify_receive_message(event.message.source, message);
-		free(event.message.content);
-		++num_messages;
-	} break;
-
-	default: {
-		assert(false && "Unknown event type.");
-	}
+	std::ofstream results_file(results_file_name);
+	if (!results_file.is_open()) {
+		std::cerr << "Error opening results file: " << results_file_name << std::endl;
+		exit(EXIT_FAILURE);
 	}
-}
 
-static void process_events() {
-	// Continue until no more events.
-	while (!events.empty() && (max_events < 0 || num_events < max_events)) {
-		current_time = events.begin()->first;
-
-		static event_time_t last_snapshot_epoch = -1;
-		if (!epoch_steps || current_time > last_snapshot_epoch) {
-			last_snapshot_epoch = current_time;
+	// Children inherit the stream buffers, don't let them write ours twice.
+	std::cout.flush();
+	std::cerr.flush();
 
-			if (!epoch_steps || changed) {
-				dump_network_snapshot(steps_dot_file);
-				changed = false;
+	std::vector<std::string> rows(scenarios.size());
+	std::map<pid_t, std::pair<size_t, int>> running; // Child -> <scenario, pipe>
+	size_t next_scenario = 0, num_failed = 0;
+	while (next_scenario < scenarios.size() || !running.empty()) {
+		if (next_scenario < scenarios.size() && (int)running.size() < sweep_jobs) {
+			int fds[2];
+			if (pipe(fds) < 0) {
+				std::cerr << "Error creating pipe for scenario." << std::endl;
+				exit(EXIT_FAILURE);
+			}
+			pid_t pid = fork();
+			if (pid < 0) {
+				std::cerr << "Error starting scenario." << std::endl;
+				exit(EXIT_FAILURE);
+			} else if (pid == 0) {
+				close(fds[0]);
+				run_scenario(scenarios[next_scenario], fds[1]);
 			}
+			close(fds[1]);
+			running[pid] = std::make_pair(next_scenario++, fds[0]);
+			continue;
 		}
 
-		// Remove event from queue and process it.
-		event_t event = events.begin()->second;
-		events.erase(events.begin());
+		// Collect the next scenario to finish. Rows are small enough to
+		// wait in the pipe until then.
+		int status;
+		struct rusage usage;
+		pid_t pid = wait4(-1, &status, 0, &usage);
+		if (pid < 0 || !running.count(pid)) {
+			continue;
+		}
+		auto child = running[pid];
+		running.erase(pid);
 
-		process_event(event);
-		++num_events;
+		std::string &row = rows[child.first];
+		char buffer[4096];
+		ssize_t length;
+		while ((length = read(child.second, buffer, sizeof(buffer))) > 0) {
+			row.append(buffer, length);
+		}
+		close(child.second);
+
+		if (WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS && !row.empty()) {
+			row += "," + std::to_string(usage.ru_maxrss);
+		} else {
+			row = scenarios[child.first] + ",failed,,,,,,,";
+			++num_failed;
+		}
 	}
-	if (!epoch_steps || changed) {
-		dump_network_snapshot(steps_dot_file);
+
+	results_file << "scenario,status,events,link_changes,messages,message_bytes,convergence_epoch,wall_s,peak_rss_kb\n";
+	for (auto &row : rows) {
+		results_file << row << '\n';
 	}
-	dump_network_snapshot(final_dot_file);
+	std::cout << "Swept " << scenarios.size() << " scenarios over a network of " << nodes.size() << " nodes, " << num_failed << " failed." << std::endl;
 }
 
 static void show_usage(std::string command) {
 	std::cerr                                                             //
 	    << "Usage: " << command                                           //
+	    << " [--checkpoint-at <epoch> <file>]"                            //
+	    << " [--coalesce-messages]"                                       //
 	    << " [--epoch-steps]"                                             //
 	    << " [--final-dot <dot-file>]"                                    //
 	    << " [--help]"                                                    //
 	    << " [--hide-future-messages]"                                    //
 	    << " [--hide-messages]"                                           //
 	    << " [--max-events <limit>]"                                      //
+	    << " [--profile-handlers <top-nodes>]"                            //
+	    << " [--progress <seconds>]"                                      //
+	    << " [--restore <file>]"                                          //
 	    << " [--show-routes-for <node>]"                                  //
+	    << " [--stats-csv <csv-file>]"                                    //
+	    << " [--stats-json <json-file>]"                                  //
 	    << " [--steps-dot <dot-file>]"                                    //
+	    << " [--sweep <scenario-list> <csv-file>]"                        //
+	    << " [--sweep-jobs <count>]"                                      //
+	    << " [--threads <count>]"                                         //
+	    << " [--trace <trace-file>]"                                      //
 	    << " [--] <topology-file>" << std::endl                           //
 	    << std::endl                                                      //
+	    << " --checkpoint-at <epoch> <file> "                             //
+	    << "- Save the simulation to <file> before the first event of "   //
+	    << "<epoch>, or at the end if it ends first."                     //
+	    << std::endl                                                      //
+	    << " --coalesce-messages       "                                  //
+	    << "- Only deliver the last message a node sends on each link "   //
+	    << "during an epoch (default: deliver all)."                      //
+	    << std::endl                                                      //
 	    << " --epoch-steps             "                                  //
 	    << "- Only show one step per epoch in the steps dot file."        //
 	    << std::endl                                                      //
@@ -330,12 +1798,45 @@ static void show_usage(std::string command) {
 	    << "- Put a limit on the number of simulation events to process " //
 	    << "(default: no limit)."                                         //
 	    << std::endl                                                      //
+	    << " --profile-handlers <top-nodes> "                             //
+	    << "- Time handlers, and report their latency and the "           //
+	    << "<top-nodes> slowest nodes at exit."                           //
+	    << std::endl                                                      //
+	    << " --progress <seconds>      "                                  //
+	    << "- Show progress on stderr every <seconds>, at most once "     //
+	    << "per epoch or 65536 events (default: never)."                  //
+	    << std::endl                                                      //
+	    << " --restore <file>          "                                  //
+	    << "- Continue a simulation saved with --checkpoint-at, "         //
+	    << "instead of loading <topology-file>."                          //
+	    << std::endl                                                      //
 	    << " --show-routes-for <node>  "                                  //
 	    << "- Declutter dot files by only showing routes for <node> "     //
 	    << "(default: show all)."                                         //
 	    << std::endl                                                      //
+	    << " --stats-csv <csv-file>    "                                  //
+	    << "- Write stats for each epoch as CSV."                         //
+	    << std::endl                                                      //
+	    << " --stats-json <json-file>  "                                  //
+	    << "- Write stats for each epoch as JSON lines."                  //
+	    << std::endl                                                      //
 	    << " --steps-dot <dot-file>    "                                  //
 	    << "- Generate a dot file showing each simulation step."          //
+	    << std::endl                                                      //
+	    << " --sweep <scenario-list> <csv-file> "                         //
+	    << "- Run each .net file in <scenario-list> on top of the "       //
+	    << "topology, which is loaded once, and write a row for each."    //
+	    << std::endl                                                      //
+	    << " --sweep-jobs <count>      "                                  //
+	    << "- Run <count> sweep scenarios at a time "                     //
+	    << "(default: one per CPU)."                                      //
+	    << std::endl                                                      //
+	    << " --threads <count>         "                                  //
+	    << "- Deliver each epoch's messages on <count> threads, "         //
+	    << "implies --epoch-steps (default: 1)."                          //
+	    << std::endl                                                      //
+	    << " --trace <trace-file>      "                                  //
+	    << "- Record a compact binary trace, for trace2dot to render."    //
 	    << std::endl;
 	exit(EXIT_FAILURE);
 }
@@ -345,6 +1846,12 @@ static void report_stats() {
 	          << "Processed " << num_link_changes << " link change events." << std::endl
 	          << "Processed " << num_messages << " messages." << std::endl
 	          << "Simulation converged after " << current_time << " time epochs." << std::endl;
+	if (coalesce_messages) {
+		std::cout << "Coalesced " << num_coalesced_messages << " messages." << std::endl;
+	}
+	for (auto &counter : sum_router_counters()) {
+		std::cout << "Counted " << counter.second << " " << counter.first << "." << std::endl;
+	}
 }
 
 int main(int argc, char *argv[]) {
@@ -352,11 +1859,29 @@ int main(int argc, char *argv[]) {
 	std::string topology_file_name;
 	std::string steps_dot_file_name = "/dev/null";
 	std::string final_dot_file_name = "/dev/null";
+	std::string trace_file_name = "/dev/null";
+	std::string restore_file_name;
+	std::string stats_csv_file_name = "/dev/null";
+	std::string stats_json_file_name = "/dev/null";
+	std::string sweep_list_file_name;
+	std::string sweep_results_file_name;
 	bool positional_mode = false;
 
 	for (int a = 1; a < argc; ++a) {
 		std::string arg = argv[a];
-		if (arg == "--epoch-steps") {
+		if (arg == "--checkpoint-at") {
+			if (argc <= a + 2) {
+				show_usage(argv[0]);
+			}
+			try {
+				checkpoint_epoch = std::stoi(argv[++a]);
+			} catch (...) {
+				show_usage(argv[0]);
+			}
+			checkpoint_file_name = argv[++a];
+		} else if (arg == "--coalesce-messages") {
+			coalesce_messages = true;
+		} else if (arg == "--epoch-steps") {
 			epoch_steps = true;
 		} else if (arg == "--final-dot") {
 			if (argc <= a + 1) {
@@ -378,6 +1903,32 @@ int main(int argc, char *argv[]) {
 			} catch (...) {
 				show_usage(argv[0]);
 			}
+		} else if (arg == "--profile-handlers") {
+			if (argc <= a + 1) {
+				show_usage(argv[0]);
+			}
+			try {
+				profile_top_nodes = std::stoi(argv[++a]);
+			} catch (...) {
+				show_usage(argv[0]);
+			}
+			if (profile_top_nodes < 0) {
+				show_usage(argv[0]);
+			}
+		} else if (arg == "--progress") {
+			if (argc <= a + 1) {
+				show_usage(argv[0]);
+			}
+			try {
+				progress_interval = std::stod(argv[++a]);
+			} catch (...) {
+				show_usage(argv[0]);
+			}
+		} else if (arg == "--restore") {
+			if (argc <= a + 1) {
+				show_usage(argv[0]);
+			}
+			restore_file_name = argv[++a];
 		} else if (arg == "--show-routes-for") {
 			if (argc <= a + 1) {
 				show_usage(argv[0]);
@@ -387,11 +1938,58 @@ int main(int argc, char *argv[]) {
 			} catch (...) {
 				show_usage(argv[0]);
 			}
+		} else if (arg == "--stats-csv") {
+			if (argc <= a + 1) {
+				show_usage(argv[0]);
+			}
+			stats_csv_file_name = argv[++a];
+		} else if (arg == "--stats-json") {
+			if (argc <= a + 1) {
+				show_usage(argv[0]);
+			}
+			stats_json_file_name = argv[++a];
 		} else if (arg == "--steps-dot") {
 			if (argc <= a + 1) {
 				show_usage(argv[0]);
 			}
 			steps_dot_file_name = argv[++a];
+		} else if (arg == "--sweep") {
+			if (argc <= a + 2) {
+				show_usage(argv[0]);
+			}
+			sweep_list_file_name = argv[++a];
+			sweep_results_file_name = argv[++a];
+		} else if (arg == "--sweep-jobs") {
+			if (argc <= a + 1) {
+				show_usage(argv[0]);
+			}
+			try {
+				sweep_jobs = std::stoi(argv[++a]);
+			} catch (...) {
+				show_usage(argv[0]);
+			}
+			if (sweep_jobs < 1) {
+				show_usage(argv[0]);
+			}
+		} else if (arg == "--threads") {
+			if (argc <= a + 1) {
+				show_usage(argv[0]);
+			}
+			try {
+				num_threads = std::stoi(argv[++a]);
+			} catch (...) {
+				show_usage(argv[0]);
+			}
+			if (num_threads < 1) {
+				show_usage(argv[0]);
+			}
+			// Steps are only well defined at epoch barriers.
+			epoch_steps = epoch_steps || num_threads > 1;
+		} else if (arg == "--trace") {
+			if (argc <= a + 1) {
+				show_usage(argv[0]);
+			}
+			trace_file_name = argv[++a];
 		} else if (arg == "--") {
 			positional_mode = true;
 		} else {
@@ -403,35 +2001,67 @@ int main(int argc, char *argv[]) {
 		}
 	}
 
-	if (topology_file_name.empty()) {
-		show_usage(argv[0]);
-	}
-	topology_file.open(topology_file_name);
-	if (!topology_file.is_open()) {
-		std::cerr << "Error opening topology file: " << topology_file_name << std::endl;
+	if (restore_file_name.empty()) {
+		if (topology_file_name.empty()) {
+			show_usage(argv[0]);
+		}
+		topology_file.open(topology_file_name);
+		if (!topology_file.is_open()) {
+			std::cerr << "Error opening topology file: " << topology_file_name << std::endl;
+			exit(EXIT_FAILURE);
+		}
+	} else if (trace_file_name != "/dev/null") {
+		// A trace replays from the start of the simulation.
+		std::cerr << "Can't trace a restored simulation." << std::endl;
 		exit(EXIT_FAILURE);
 	}
+	const char *slash = strrchr(argv[0], '/');
+	simulator_name = slash ? slash + 1 : argv[0];
 
-	steps_dot_file.open(steps_dot_file_name);
-	if (!steps_dot_file.is_open()) {
-		std::cerr << "Error opening output file: " << steps_dot_file_name << std::endl;
-		exit(EXIT_FAILURE);
+	if (!sweep_list_file_name.empty()) {
+		// Scenarios only report their results.
+		if (!restore_file_name.empty() || !checkpoint_file_name.empty() || profile_top_nodes >= 0 || steps_dot_file_name != "/dev/null" ||
+		    final_dot_file_name != "/dev/null" || trace_file_name != "/dev/null" || stats_csv_file_name != "/dev/null" || stats_json_file_name != "/dev/null") {
+			std::cerr << "Can't write other outputs from a sweep." << std::endl;
+			exit(EXIT_FAILURE);
+		}
+		load_topology_events(topology_file_name);
+		run_sweep(sweep_list_file_name, sweep_results_file_name);
+		return 0;
 	}
 
-	final_dot_file.open(final_dot_file_name);
-	if (!final_dot_file.is_open()) {
-		std::cerr << "Error opening output file: " << final_dot_file_name << std::endl;
-		exit(EXIT_FAILURE);
-	}
+	open_output_file(steps_dot_output, steps_dot_file_name);
+	open_output_file(final_dot_output, final_dot_file_name);
+	open_output_file(trace_output, trace_file_name);
+	open_output_file(stats_csv_output, stats_csv_file_name);
+	open_output_file(stats_json_output, stats_json_file_name);
 
-	// Load network topology and create the initial set of link change events.
-	load_topology_events();
-	// Initialize each node's state.
-	init_node_states();
+	if (restore_file_name.empty()) {
+		// Load network topology and create the initial set of link change events.
+		load_topology_events(topology_file_name);
+		write_trace_header();
+		// Initialize each node's state.
+		init_node_states();
+	} else {
+		// Continue from a checkpoint.
+		load_checkpoint(restore_file_name);
+	}
 	// Process events until none are left.
+	if (num_threads > 1) {
+		start_workers();
+	}
+	start_stats();
+	start_profile();
 	process_events();
+	stop_workers();
+	close_output_file(steps_dot_output);
+	close_output_file(final_dot_output);
+	close_output_file(trace_output);
+	close_output_file(stats_csv_output);
+	close_output_file(stats_json_output);
 	// Show final report.
 	report_stats();
+	report_profile();
 	return 0;
 }
 
@@ -443,48 +2073,157 @@ node_t get_current_node() { return current_node; }
 
 event_time_t get_current_time() { return current_time; }
 
-void *get_state() { return node_states[current_node]; }
+void *get_state() { return node_states.find(current_node)->second; }
 
-node_t get_first_node() { return *nodes.begin(); }
+// An empty topology has no nodes to iterate over, from 0 to -1.
+node_t get_first_node() { return nodes.empty() ? 0 : *nodes.begin(); }
 
 node_t get_next_node(node_t node) { return node + 1; }
 
-node_t get_last_node() { return *nodes.rbegin(); }
+node_t get_last_node() { return nodes.empty() ? -1 : *nodes.rbegin(); }
+
+node_t get_node_count() { return topology_size; }
 
 cost_t get_link_cost(node_t neighbor) { return get_topology_cost(current_node, neighbor); }
 
+int get_links(const link_t **links) {
+	*links = topology_links.data() + topology_offsets[current_node];
+	return topology_offsets[current_node + 1] - topology_offsets[current_node];
+}
+
 void set_route(node_t destination, node_t next_hop, cost_t cost) {
 	assert(nodes.count(current_node) && "Current node unknown.");
 	assert((nodes.count(destination) || cost == COST_INFINITY) && "Route destination unknown.");
 	assert((nodes.count(next_hop) || cost == COST_INFINITY) && "Route next hop unknown.");
 	assert((get_link_cost(next_hop) < COST_INFINITY || cost == COST_INFINITY) && "Route next hop not a neighbor.");
 
-	if (cost < COST_INFINITY) {
-		if ((!routes[current_node].count(destination)) || routes[current_node][destination] != std::make_pair(next_hop, cost)) {
-			changed = true;
-		}
-
-		routes[current_node][destination] = std::make_pair(next_hop, cost);
-	} else {
-		if (routes[current_node].count(destination)) {
-			changed = true;
-		}
+	// Nodes outside the table never have routes to remove.
+	if (destination < 0 || destination >= topology_size) {
+		return;
+	}
 
-		routes[current_node].erase(destination);
+	size_t route = (size_t)current_node * topology_size + destination;
+	if (cost < COST_INFINITY ? route_costs[route] == cost && route_next_hops[route] == next_hop : route_costs[route] == COST_INFINITY) {
+		return;
 	}
-}
 
-void send_message(node_t neighbor, message_t message) {
-	assert(neighbor != current_node && "Sending message to self.");
-	assert(get_link_cost(neighbor) < COST_INFINITY && "Message destination not a neighbor.");
+	changed = true;
+	dirty_route_nodes[current_node] = true;
+	num_route_changes.fetch_add(1, std::memory_order_relaxed);
+	add_trace_record(TRACE_ROUTE, cost, current_node, destination, next_hop);
+	route_next_hops[route] = next_hop;
+	route_costs[route] = cost;
+}
 
-	// Send message during the next epoch.
+// Send message during the next epoch.
+static void queue_message(node_t neighbor, message_t message) {
 	event_t event;
 	event.type = MESSAGE;
 	event.message.source = current_node;
 	event.message.destination = neighbor;
-	event.message.content = malloc(message.size);
-	memcpy(event.message.content, message.data, message.size);
+	event.message.content = message.data;
 	event.message.size = message.size;
-	events.insert(std::make_pair(current_time + 1, event));
+	if (outbox) {
+		outbox->push_back(event);
+	} else {
+		add_next_epoch_message(event);
+	}
+}
+
+void send_message(node_t neighbor, message_t message) {
+	assert(neighbor != current_node && "Sending message to self.");
+	assert(get_link_cost(neighbor) < COST_INFINITY && "Message destination not a neighbor.");
+
+	// Copy the message into the epoch arena, it's dead once delivered.
+	message_header_t *header = (message_header_t *)arena_alloc(sizeof(message_header_t) + message.size);
+	new (&header->references) std::atomic<int>(0);
+	header->in_arena = true;
+	memcpy((void *)(header + 1), message.data, message.size);
+
+	message_t copy;
+	copy.data = header + 1;
+	copy.size = message.size;
+	queue_message(neighbor, copy);
+}
+
+message_t create_message(int size) {
+	// Messages are delivered on the next epoch, before the arena is reused.
+	message_header_t *header = (message_header_t *)arena_alloc(sizeof(message_header_t) + size);
+	new (&header->references) std::atomic<int>(0);
+	header->in_arena = true;
+
+	message_t message;
+	message.data = header + 1;
+	message.size = size;
+	return message;
+}
+
+message_t retain_message(message_t message) {
+	message_header_t *header = (message_header_t *)message.data - 1;
+	if (header->in_arena) {
+		// Arena messages die with their epoch, keep a copy instead.
+		message_t copy = create_heap_message(message.size);
+		memcpy(copy.data, message.data, message.size);
+		return copy;
+	}
+
+	header->references.fetch_add(1, std::memory_order_relaxed);
+	return message;
+}
+
+void release_message(message_t message) {
+	if (!message.data) {
+		return;
+	}
+
+	message_header_t *header = (message_header_t *)message.data - 1;
+	if (!header->in_arena && header->references.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+		free(header);
+	}
+}
+
+void send_shared_message(node_t neighbor, message_t message) {
+	assert(neighbor != current_node && "Sending message to self.");
+	assert(get_link_cost(neighbor) < COST_INFINITY && "Message destination not a neighbor.");
+
+	// Hold a reference until delivery. Arena messages last until then anyway.
+	message_header_t *header = (message_header_t *)message.data - 1;
+	if (!header->in_arena) {
+		header->references.fetch_add(1, std::memory_order_relaxed);
+	}
+	queue_message(neighbor, message);
+}
+
+int get_coalesce_messages() { return coalesce_messages; }
+
+int get_counter(const char *name) {
+	std::lock_guard<std::mutex> lock(router_counters_mutex);
+	auto counter = std::find(router_counter_names.begin(), router_counter_names.end(), name);
+	if (counter != router_counter_names.end()) {
+		return counter - router_counter_names.begin();
+	}
+	router_counter_names.push_back(name);
+	return router_counter_names.size() - 1;
+}
+
+void add_counter(int counter, long amount) {
+	// Counters registered since the thread's last count, or a thread's first
+	// count, grow its counters under the lock. Others only touch its own.
+	if (!thread_counters || (size_t)counter >= thread_counters->size()) {
+		std::lock_guard<std::mutex> lock(router_counters_mutex);
+		if (!thread_counters) {
+			thread_counters = new std::vector<long>();
+			router_counters.push_back(thread_counters);
+		}
+		thread_counters->resize(router_counter_names.size());
+	}
+	(*thread_counters)[counter] += amount;
+}
+
+void broadcast_message(message_t message) {
+	for (size_t l = topology_offsets[current_node]; l < topology_offsets[current_node + 1]; l++) {
+		if (topology_links[l].cost < COST_INFINITY) {
+			send_shared_message(topology_links[l].neighbor, message);
+		}
+	}
 }
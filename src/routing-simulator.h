@@ -1,7 +1,6 @@
 #include <stdint.h>
 
 typedef int node_t;
-#define MAX_NODES 100
 typedef int event_time_t;
 typedef uint8_t cost_t;
 #define COST_INFINITY 255
@@ -31,6 +30,16 @@ void notify_link_change(node_t neighbor, cost_t new_cost);
 // Receive a message sent by a neighboring node.
 void notify_receive_message(node_t sender, message_t message);
 
+// Handlers to save and restore the current node's state in checkpoints.
+// Get the size of the node's state, serialized.
+int state_size();
+
+// Serialize the node's state into buffer, of state_size() bytes.
+void serialize_state(void *buffer);
+
+// Allocate the node's state from a buffer filled by serialize_state.
+void *deserialize_state(const void *buffer, int size);
+
 // Commands to use.
 // Get the current node ID.
 node_t get_current_node();
@@ -46,14 +55,61 @@ node_t get_first_node();
 node_t get_next_node(node_t node);
 node_t get_last_node();
 
+// Get the number of node IDs, one past the last node. Use it to size per-node arrays.
+node_t get_node_count();
+
 // Get the cost of a neighboring link. returns COST_INFINITY if not a neighbor.
 cost_t get_link_cost(node_t neighbor);
 
+// A link to a neighboring node.
+typedef struct link {
+	node_t neighbor;
+	cost_t cost;
+} link_t;
+
+// Get the current node's links, sorted by neighbor, and return how many there are.
+// Links that are down cost COST_INFINITY. The costs are kept up to date.
+int get_links(const link_t **links);
+
 // Set or update the rout to destination, via the next_hop.
 void set_route(node_t destination, node_t next_hop, cost_t cost);
 
-// Send a message to a neighboring node.
+// Messages in flight are saved as they are in checkpoints, so message data
+// should not hold pointers.
+// Send a message to a neighboring node. The message data is copied.
 void send_message(node_t neighbor, message_t message);
 
+// Shared messages.
+// Allocate a message buffer, immutable once sent, from the epoch arena. It stays
+// valid until the messages sent during this epoch are delivered, or for good
+// with retain_message. The caller must release it when done.
+message_t create_message(int size);
+
+// Keep a reference to a message, e.g. one received in notify_receive_message,
+// beyond the handler. Returns the message to keep.
+message_t retain_message(message_t message);
+
+// Drop a reference to a message from create_message or retain_message.
+void release_message(message_t message);
+
+// Send a message from create_message to a neighboring node, without copying it.
+void send_shared_message(node_t neighbor, message_t message);
+
+// Send a message from create_message to every neighboring node, without copying it.
+void broadcast_message(message_t message);
+
+// Get the ID of the router's counter called name, e.g. "full SPF runs", once,
+// to add to it. Counters are shown in the final report.
+int get_counter(const char *name);
+
+// Add amount to a counter from get_counter.
+void add_counter(int counter, long amount);
+
+// Check whether messages are coalesced (--coalesce-messages): a message replaces
+// the one sent earlier in the same epoch to the same neighbor, so only the last
+// one is delivered. Each message must then stand on its own, e.g. as a full
+// vector rather than changes to the previous message.
+int get_coalesce_messages();
+
 // extern int current_time;
 }
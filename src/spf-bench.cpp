@@ -0,0 +1,176 @@
+/******************************************************************************\
+* Microbenchmark of the link state router's shortest path computation.         *
+*                                                                              *
+* Loads a random network into one node's link state database, through the      *
+* router's checkpoint format, and times dijkstra on it.                        *
+*                                                                              *
+* Usage: spf-bench [--degree <links-per-node>] [--seed <seed>] [nodes...]      *
+\******************************************************************************/
+
+#include "routing-simulator.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+// Router module entry point being measured.
+void dijkstra();
+
+// Minimum time to spend running each size.
+#define MIN_SECONDS 0.5
+
+static node_t num_nodes;
+static std::vector<std::vector<link_t>> network;
+static void *state;
+
+/******************************************************************************\
+* Router API, for a single node with no messages.                              *
+\******************************************************************************/
+
+node_t get_current_node() { return 0; }
+
+event_time_t get_current_time() { return 0; }
+
+void *get_state() { return state; }
+
+node_t get_first_node() { return 0; }
+
+node_t get_next_node(node_t node) { return node + 1; }
+
+node_t get_last_node() { return num_nodes - 1; }
+
+node_t get_node_count() { return num_nodes; }
+
+int get_links(const link_t **links) {
+	*links = network[0].data();
+	return network[0].size();
+}
+
+void set_route(node_t destination, node_t next_hop, cost_t cost) {}
+
+message_t create_message(int size) {
+	message_t message;
+	message.data = malloc(size);
+	message.size = size;
+	return message;
+}
+
+void release_message(message_t message) { free(message.data); }
+
+void send_shared_message(node_t neighbor, message_t message) {}
+
+void broadcast_message(message_t message) {}
+
+int get_counter(const char *name) { return 0; }
+
+void add_counter(int counter, long amount) {}
+
+int get_coalesce_messages() { return 0; }
+
+/******************************************************************************\
+* Benchmark.                                                                   *
+\******************************************************************************/
+
+// Random connected network: a ring, plus random links up to the average degree.
+static void make_network(std::mt19937 &random_engine, int degree) {
+	std::uniform_int_distribution<int> random_node(0, num_nodes - 1);
+	std::uniform_int_distribution<int> random_cost(1, 10);
+	network.assign(num_nodes, std::vector<link_t>());
+	auto add_link = [](node_t first_node, node_t second_node, cost_t cost) {
+		network[first_node].push_back({second_node, cost});
+		network[second_node].push_back({first_node, cost});
+	};
+	for (node_t node = 0; node < num_nodes; node++) {
+		add_link(node, (node + 1) % num_nodes, random_cost(random_engine));
+	}
+	for (long l = num_nodes; l < (long)num_nodes * degree / 2; l++) {
+		node_t first_node = random_node(random_engine), second_node = random_node(random_engine);
+		if (first_node != second_node) {
+			add_link(first_node, second_node, random_cost(random_engine));
+		}
+	}
+}
+
+// Fill the node's state with every node's links, as checkpointed: the link
+// costs of every node, then via and versions.
+static void load_state() {
+	std::vector<char> buffer(state_size());
+	cost_t *cost = (cost_t *)buffer.data();
+	memset(cost, COST_INFINITY, (size_t)num_nodes * num_nodes);
+	for (node_t node = 0; node < num_nodes; node++) {
+		cost[(size_t)node * num_nodes + node] = 0;
+		for (auto &link : network[node]) {
+			cost[(size_t)node * num_nodes + link.neighbor] = link.cost;
+		}
+	}
+	node_t *via = (node_t *)(cost + (size_t)num_nodes * num_nodes);
+	int *version = (int *)(via + num_nodes);
+	for (node_t node = 0; node < num_nodes; node++) {
+		via[node] = -1;
+		version[node] = 1;
+	}
+	state = deserialize_state(buffer.data(), buffer.size());
+}
+
+static void show_usage(std::string command) {
+	std::cerr << "Usage: " << command << " [--degree <links-per-node>] [--seed <seed>] [nodes...]" << std::endl;
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+	int degree = 4;
+	std::mt19937 random_engine(1);
+	std::vector<node_t> sizes;
+	try {
+		for (int a = 1; a < argc; ++a) {
+			std::string arg = argv[a];
+			if (arg == "--degree" && a + 1 < argc) {
+				degree = std::stoi(argv[++a]);
+			} else if (arg == "--seed" && a + 1 < argc) {
+				random_engine.seed(std::stoi(argv[++a]));
+			} else if (arg.rfind("-", 0) == 0) {
+				show_usage(argv[0]);
+			} else {
+				sizes.push_back(std::stoi(arg));
+			}
+		}
+	} catch (...) {
+		show_usage(argv[0]);
+	}
+	if (sizes.empty()) {
+		sizes = {100, 1000, 10000};
+	}
+
+	std::cout << "nodes\tlinks\truns\tus_per_run" << std::endl;
+	for (node_t size : sizes) {
+		if (size < 2 || degree < 2) {
+			show_usage(argv[0]);
+		}
+		num_nodes = size;
+		make_network(random_engine, degree);
+		load_state();
+
+		long links = 0;
+		for (auto &node_links : network) {
+			links += node_links.size();
+		}
+
+		long runs = 0;
+		auto start_time = std::chrono::steady_clock::now();
+		double seconds;
+		do {
+			dijkstra();
+			++runs;
+			seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+		} while (seconds < MIN_SECONDS);
+
+		std::cout << size << '\t' << links / 2 << '\t' << runs << '\t' << seconds * 1e6 / runs << std::endl;
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,32 @@
+/******************************************************************************\
+* Binary topology file format.                                                 *
+*                                                                              *
+* Fixed-size records, in native byte order, meant to be memory mapped by the   *
+* simulator instead of parsed. Written from .net text files by net2bin.        *
+\******************************************************************************/
+
+#include <stdint.h>
+
+#define TOPOLOGY_MAGIC "RSIMNET1"
+
+// File header. Followed by node_count node IDs, in order of first appearance
+// in the text file, then record_count link change records.
+typedef struct {
+	char magic[8];
+	uint32_t node_count;
+	uint32_t reserved;
+	uint64_t record_count;
+} topology_header_t;
+
+// Node ID, as stored after the header.
+typedef int32_t topology_node_t;
+
+// A link change, one text file line. Records are sorted by time, and keep
+// the text file order within the same time.
+typedef struct {
+	int32_t time;
+	int32_t first_node;
+	int32_t second_node;
+	uint8_t cost;
+	uint8_t padding[3];
+} topology_record_t;
@@ -0,0 +1,59 @@
+/******************************************************************************\
+* Binary execution trace format.                                               *
+*                                                                              *
+* Written by the simulator with --trace, as a log of what changed at each      *
+* event, in the order events are processed. trace2dot replays it to rebuild    *
+* the network snapshots. Fixed-size records, in native byte order.             *
+\******************************************************************************/
+
+#include <stdint.h>
+
+#define TRACE_MAGIC "RSIMTRC1"
+
+// File header. Followed by node_count nodes, sorted by ID, then link_count
+// links, sorted, and then the records until the end of the file.
+typedef struct {
+	char magic[8];
+	uint32_t node_count;
+	uint32_t link_count;
+} trace_header_t;
+
+// A node and its color in snapshots.
+typedef struct {
+	int32_t node;
+	char color[28];
+} trace_node_t;
+
+// A link of the topology, first_node < second_node. Links start down.
+typedef struct {
+	int32_t first_node;
+	int32_t second_node;
+} trace_link_t;
+
+typedef enum {
+	// The epoch changed to time value. Follows the previous epoch's events.
+	TRACE_EPOCH = 1,
+	// Link change event: node is notified of the link to other changing to cost.
+	TRACE_LINK_CHANGE,
+	// Message event: the oldest message pending from node to other is delivered.
+	TRACE_DELIVER,
+	// Node sends a message to other, to deliver during the next epoch.
+	TRACE_SEND,
+	// Node's route to other changed to go via neighbor value with cost, or
+	// was removed if cost is COST_INFINITY.
+	TRACE_ROUTE,
+	// End of the run. If the run stopped with events left, cost has the type
+	// of the next one, TRACE_LINK_CHANGE or TRACE_DELIVER, with its nodes in
+	// node and other and its epoch in value. Otherwise cost is zero.
+	TRACE_END,
+} trace_record_type_t;
+
+// Records that happen while handling an event follow that event's record.
+typedef struct {
+	uint8_t type;
+	uint8_t cost;
+	uint8_t padding[2];
+	int32_t node;
+	int32_t other;
+	int32_t value;
+} trace_record_t;
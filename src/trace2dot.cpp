@@ -0,0 +1,352 @@
+/******************************************************************************\
+* Render network snapshots from a binary execution trace.                      *
+*                                                                              *
+* Replays a trace recorded with --trace, and writes the same dot snapshots     *
+* --steps-dot would have, for all steps or only some of them, to stdout.       *
+\******************************************************************************/
+
+#include "trace-format.h"
+
+#include <string.h>
+
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+#define COST_INFINITY 255
+
+#define COLOR_CURRENT_MESSAGE "black"
+#define COLOR_FUTURE_MESSAGE "gray"
+
+// Options.
+static bool epoch_steps = false;
+static bool show_future_messages = true;
+static bool show_messages = true;
+static int show_routes_for = -1;
+static long first_step = 0;
+static long last_step = -1;
+static long first_epoch = -1;
+static long last_epoch = -1;
+
+// Replayed network state.
+static std::vector<trace_node_t> nodes;
+static std::vector<trace_link_t> links;
+static std::vector<uint8_t> link_costs;
+static std::map<std::pair<int32_t, int32_t>, size_t> link_indexes;
+static std::map<int32_t, std::map<int32_t, std::pair<int32_t, uint8_t>>> routes;
+static std::map<int32_t, std::string> colors;
+// Messages left to deliver in the current epoch and sent for the next one.
+static std::deque<std::pair<int32_t, int32_t>> epoch_messages;
+static std::vector<std::pair<int32_t, int32_t>> next_epoch_messages;
+static int32_t current_time = -1;
+static bool changed = false;
+
+static void dump_message(std::ostream &dot_file, const std::pair<int32_t, int32_t> &message, bool current) {
+	dot_file << "  node" << message.first                                                                      //
+	         << " -> node" << message.second                                                                   //
+	         << " [ color = \"" << ((!epoch_steps) && current ? COLOR_CURRENT_MESSAGE : COLOR_FUTURE_MESSAGE) //
+	         << "\" style = \"dashed\" ];" << '\n';
+}
+
+// Same snapshot as the simulator's, with next_event the record of the event
+// about to be processed, if any.
+static void dump_network_snapshot(std::ostream &dot_file, const trace_record_t *next_event) {
+	// Graphviz header and timestamp.
+	dot_file << "digraph N {" << '\n'                             //
+	         << "  label = \"t=" << current_time << "\";" << '\n' //
+	         << "  labelloc = \"top\";" << '\n'                   //
+	         << "  labeljust = \"left\";" << '\n';
+
+	// Dump colored nodes. Highlight recipient of next event in bold.
+	for (auto &node : nodes) {
+		dot_file << "  node" << node.node                 //
+		         << " [ label = \"" << node.node << "\" " //
+		         << "style = \"filled"                    //
+		         << (((!epoch_steps) && next_event &&
+		              ((next_event->type == TRACE_LINK_CHANGE && next_event->node == node.node) ||
+		               (next_event->type == TRACE_DELIVER && next_event->other == node.node)))
+		                 ? ",bold"
+		                 : "")
+		         << "\" " //
+		         << "fillcolor = \"" << node.color << "\" ];" << '\n';
+	}
+
+	// Bold black lines for undirected topology.
+	// Add dot for interface that is being notified of change.
+	for (size_t l = 0; l < links.size(); l++) {
+		int32_t first_node = links[l].first_node;
+		int32_t second_node = links[l].second_node;
+		uint8_t cost = link_costs[l];
+
+		if (cost < COST_INFINITY || (next_event && next_event->type == TRACE_LINK_CHANGE &&
+		                             ((next_event->node == first_node && next_event->other == second_node) ||
+		                              (next_event->node == second_node && next_event->other == first_node)))) {
+			dot_file << "  node" << first_node                                                                 //
+			         << " -> node" << second_node                                                              //
+			         << " [ dir = \"both\" "                                                                   //
+			         << "label = \"" << (cost < COST_INFINITY ? std::to_string((int)cost) : "∞") << "\" " //
+			         << "style = \"bold\" "                                                                    //
+			         << "arrowtail = \""
+			         << ((!epoch_steps) && next_event && next_event->type == TRACE_LINK_CHANGE && next_event->node == first_node &&
+			                     next_event->other == second_node
+			                 ? "dot"
+			                 : "none")
+			         << "\" " //
+			         << "arrowhead = \""
+			         << ((!epoch_steps) && next_event && next_event->type == TRACE_LINK_CHANGE && next_event->node == second_node &&
+			                     next_event->other == first_node
+			                 ? "dot"
+			                 : "none")
+			         << "\"];" << '\n';
+		}
+	}
+
+	// Colored arrows for directed routes.
+	for (auto node : routes) {
+		for (auto destination : node.second) {
+			if ((show_routes_for < 0 || show_routes_for == destination.first)) {
+				dot_file << "  node" << node.first                              //
+				         << " -> node" << destination.second.first              //
+				         << " [ color = \"" << colors[destination.first]        //
+				         << "\" fontcolor = \"" << colors[destination.first]    //
+				         << "\" label = \"" << ((int)destination.second.second) //
+				         << "\" ];" << '\n';
+			}
+		}
+	}
+
+	// Dashed arrow for messages. Black if being delivered, gray for future
+	// delivery.
+	if (show_messages) {
+		bool delivering = next_event && next_event->type == TRACE_DELIVER;
+		for (size_t m = 0; m < epoch_messages.size(); m++) {
+			bool current = delivering && m == 0;
+			if (show_future_messages || current) {
+				dump_message(dot_file, epoch_messages[m], current);
+			}
+		}
+		if (show_future_messages) {
+			for (auto &message : next_epoch_messages) {
+				dump_message(dot_file, message, false);
+			}
+		}
+	}
+
+	// Footer.
+	dot_file << "}" << '\n' << '\n';
+}
+
+// Snapshot taken before the step-th event, if it's in the requested ranges.
+static void take_snapshot(long step, const trace_record_t *next_event) {
+	if (step < first_step || (last_step >= 0 && step > last_step) || current_time < first_epoch || (last_epoch >= 0 && current_time > last_epoch)) {
+		return;
+	}
+	dump_network_snapshot(std::cout, next_event);
+}
+
+static void syntax_error() {
+	std::cerr << "Syntax error in trace file." << std::endl;
+	exit(EXIT_FAILURE);
+}
+
+static void show_usage(std::string command) {
+	std::cerr                                                              //
+	    << "Usage: " << command                                            //
+	    << " [--epoch-steps]"                                              //
+	    << " [--epochs <first> <last>]"                                    //
+	    << " [--help]"                                                     //
+	    << " [--hide-future-messages]"                                     //
+	    << " [--hide-messages]"                                            //
+	    << " [--show-routes-for <node>]"                                   //
+	    << " [--steps <first> <last>]"                                     //
+	    << " [--] <trace-file>" << std::endl                               //
+	    << std::endl                                                       //
+	    << "Writes the steps dot file of a traced run to stdout."          //
+	    << std::endl                                                       //
+	    << std::endl                                                       //
+	    << " --epoch-steps             "                                   //
+	    << "- Only show one step per epoch."                               //
+	    << std::endl                                                       //
+	    << " --epochs <first> <last>   "                                   //
+	    << "- Only show steps in epochs <first> to <last>, -1 for the end." //
+	    << std::endl                                                       //
+	    << " --help                    "                                   //
+	    << "- Show this help screen."                                      //
+	    << std::endl                                                       //
+	    << " --hide-future-messages    "                                   //
+	    << "- Declutter dot files by only showing the current message "    //
+	    << "(default: show)."                                              //
+	    << std::endl                                                       //
+	    << " --hide-messages    "                                          //
+	    << "- Declutter dot files by hiding all messages "                 //
+	    << "(default: show)."                                              //
+	    << std::endl                                                       //
+	    << " --show-routes-for <node>  "                                   //
+	    << "- Declutter dot files by only showing routes for <node> "      //
+	    << "(default: show all)."                                          //
+	    << std::endl                                                       //
+	    << " --steps <first> <last>    "                                   //
+	    << "- Only show the steps before events <first> to <last>, "       //
+	    << "-1 for the end."                                               //
+	    << std::endl;
+	exit(EXIT_FAILURE);
+}
+
+static long parse_number(int argc, char *argv[], int a) {
+	if (argc <= a) {
+		show_usage(argv[0]);
+	}
+	try {
+		return std::stol(argv[a]);
+	} catch (...) {
+		show_usage(argv[0]);
+	}
+	return 0;
+}
+
+int main(int argc, char *argv[]) {
+	// Parse command-line arguments.
+	std::string trace_file_name;
+	bool positional_mode = false;
+
+	for (int a = 1; a < argc; ++a) {
+		std::string arg = argv[a];
+		if (arg == "--epoch-steps") {
+			epoch_steps = true;
+		} else if (arg == "--epochs") {
+			first_epoch = parse_number(argc, argv, ++a);
+			last_epoch = parse_number(argc, argv, ++a);
+		} else if (arg == "--help") {
+			show_usage(argv[0]);
+		} else if (arg == "--hide-future-messages") {
+			show_future_messages = false;
+		} else if (arg == "--hide-messages") {
+			show_messages = false;
+		} else if (arg == "--show-routes-for") {
+			show_routes_for = parse_number(argc, argv, ++a);
+		} else if (arg == "--steps") {
+			first_step = parse_number(argc, argv, ++a);
+			last_step = parse_number(argc, argv, ++a);
+		} else if (arg == "--") {
+			positional_mode = true;
+		} else {
+			if ((arg.rfind("-", 0) == 0 && !positional_mode) || !trace_file_name.empty()) {
+				std::cerr << "Unknown option: " << arg << std::endl;
+				show_usage(argv[0]);
+			}
+			trace_file_name = arg;
+		}
+	}
+
+	if (trace_file_name.empty()) {
+		show_usage(argv[0]);
+	}
+	std::ifstream trace_file(trace_file_name, std::ios::binary);
+	if (!trace_file.is_open()) {
+		std::cerr << "Error opening trace file: " << trace_file_name << std::endl;
+		exit(EXIT_FAILURE);
+	}
+
+	// Read the nodes and links.
+	trace_header_t header;
+	if (!trace_file.read((char *)&header, sizeof(header)) || memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic))) {
+		syntax_error();
+	}
+	nodes.resize(header.node_count);
+	links.resize(header.link_count);
+	if (!trace_file.read((char *)nodes.data(), sizeof(trace_node_t) * nodes.size()) ||
+	    !trace_file.read((char *)links.data(), sizeof(trace_link_t) * links.size())) {
+		syntax_error();
+	}
+	for (auto &node : nodes) {
+		node.color[sizeof(node.color) - 1] = '\0';
+		colors[node.node] = node.color;
+		routes[node.node];
+	}
+	link_costs.assign(links.size(), COST_INFINITY);
+	for (size_t l = 0; l < links.size(); l++) {
+		link_indexes[std::make_pair(links[l].first_node, links[l].second_node)] = l;
+	}
+
+	// Replay the records, taking snapshots where the simulator did.
+	long step = 0;
+	int32_t last_snapshot_epoch = -1;
+	trace_record_t record;
+	while (trace_file.read((char *)&record, sizeof(record))) {
+		switch (record.type) {
+		case TRACE_EPOCH: {
+			// Messages sent during the previous epoch are delivered now.
+			current_time = record.value;
+			epoch_messages.insert(epoch_messages.end(), next_epoch_messages.begin(), next_epoch_messages.end());
+			next_epoch_messages.clear();
+		} break;
+
+		case TRACE_LINK_CHANGE:
+		case TRACE_DELIVER: {
+			if (!epoch_steps || current_time > last_snapshot_epoch) {
+				last_snapshot_epoch = current_time;
+
+				if (!epoch_steps || changed) {
+					take_snapshot(step, &record);
+					changed = false;
+				}
+			}
+
+			if (record.type == TRACE_LINK_CHANGE) {
+				auto link = link_indexes.find(std::make_pair(std::min(record.node, record.other), std::max(record.node, record.other)));
+				if (link == link_indexes.end()) {
+					syntax_error();
+				}
+				link_costs[link->second] = record.cost;
+				changed = true;
+			} else {
+				if (epoch_messages.empty() || epoch_messages.front() != std::make_pair(record.node, record.other)) {
+					syntax_error();
+				}
+				epoch_messages.pop_front();
+			}
+			++step;
+		} break;
+
+		case TRACE_SEND: {
+			next_epoch_messages.push_back(std::make_pair(record.node, record.other));
+		} break;
+
+		case TRACE_ROUTE: {
+			if (record.cost < COST_INFINITY) {
+				routes[record.node][record.other] = std::make_pair(record.value, record.cost);
+			} else {
+				routes[record.node].erase(record.other);
+			}
+			changed = true;
+		} break;
+
+		case TRACE_END: {
+			// The simulator looked ahead at the next event, which may have
+			// started the next epoch.
+			trace_record_t next_event = record;
+			next_event.type = record.cost;
+			if (next_event.type && record.value > current_time) {
+				epoch_messages.insert(epoch_messages.end(), next_epoch_messages.begin(), next_epoch_messages.end());
+				next_epoch_messages.clear();
+			}
+
+			if (!epoch_steps || changed) {
+				take_snapshot(step, next_event.type ? &next_event : NULL);
+			}
+			return EXIT_SUCCESS;
+		}
+
+		default: {
+			syntax_error();
+		}
+		}
+	}
+
+	// The run didn't finish writing the trace.
+	syntax_error();
+	return EXIT_FAILURE;
+}